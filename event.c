@@ -0,0 +1,104 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "usteer.h"
+#include "event.h"
+
+const char * const event_types[__EVENT_TYPE_MAX] = {
+	[EVENT_TYPE_PROBE] = "probe",
+	[EVENT_TYPE_AUTH] = "auth",
+	[EVENT_TYPE_ASSOC] = "assoc",
+	[EVENT_TYPE_BEACON] = "beacon-report",
+};
+
+const char * const hostapd_events[__HOSTAPD_EVENT_MAX] = {
+	[EVENT_TYPE_PROBE] = "probe",
+	[EVENT_TYPE_AUTH] = "auth",
+	[EVENT_TYPE_ASSOC] = "assoc",
+	[EVENT_TYPE_BEACON] = "beacon-report",
+	[HOSTAPD_EVENT_BTM_RESPONSE] = "bss-transition-response",
+};
+
+/* 0x10 marks characters that are not hex digits */
+static const uint8_t hex_digit[256] = {
+	[0 ... 255] = 0x10,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+/* strict "xx:xx:xx:xx:xx:xx" as sent by hostapd, reentrant unlike ether_aton() */
+bool
+usteer_parse_macaddr(struct blob_attr *attr, uint8_t *addr)
+{
+	const uint8_t *str = blobmsg_data(attr);
+	uint8_t bad = 0;
+	int i;
+
+	if (blobmsg_data_len(attr) != 18)
+		return false;
+
+	for (i = 0; i < 6; i++) {
+		uint8_t hi = hex_digit[str[3 * i]];
+		uint8_t lo = hex_digit[str[3 * i + 1]];
+
+		bad |= (hi | lo) & 0x10;
+		addr[i] = (hi << 4) | (lo & 0xf);
+	}
+
+	for (i = 0; i < 5; i++)
+		bad |= str[3 * i + 2] ^ ':';
+
+	return !bad && !str[17];
+}
+
+/* one compare per event instead of walking all known names */
+enum usteer_event_handler
+usteer_event_lookup(const char *method, enum usteer_event_type *type)
+{
+	const char *name;
+	enum usteer_event_handler handler = EVENT_HANDLER_STA;
+
+	switch (method[0]) {
+	case 'p':
+		*type = EVENT_TYPE_PROBE;
+		break;
+	case 'a':
+		*type = method[1] == 'u' ? EVENT_TYPE_AUTH : EVENT_TYPE_ASSOC;
+		break;
+	case 'b':
+		if (method[1] == 'e') {
+			*type = EVENT_TYPE_BEACON;
+			handler = EVENT_HANDLER_BEACON;
+			break;
+		}
+
+		if (strcmp(method, hostapd_events[HOSTAPD_EVENT_BTM_RESPONSE]) != 0)
+			return EVENT_HANDLER_UNKNOWN;
+
+		return EVENT_HANDLER_BTM;
+	default:
+		return EVENT_HANDLER_UNKNOWN;
+	}
+
+	name = event_types[*type];
+	if (strcmp(method, name) != 0)
+		return EVENT_HANDLER_UNKNOWN;
+
+	return handler;
+}
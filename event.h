@@ -0,0 +1,49 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __APMGR_EVENT_H
+#define __APMGR_EVENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libubox/blobmsg.h>
+
+#include "usteer.h"
+
+/*
+ * Front end of the hostapd notification handler. It has no dependencies on
+ * the rest of the daemon, so the replay benchmark (event_bench.c) links it
+ * on its own.
+ */
+/* event_types, followed by the notifications that are no station events */
+enum {
+	HOSTAPD_EVENT_BTM_RESPONSE = __EVENT_TYPE_MAX,
+	__HOSTAPD_EVENT_MAX
+};
+
+extern const char * const hostapd_events[__HOSTAPD_EVENT_MAX];
+
+enum usteer_event_handler {
+	EVENT_HANDLER_STA,
+	EVENT_HANDLER_BEACON,
+	EVENT_HANDLER_BTM,
+	EVENT_HANDLER_UNKNOWN,
+};
+
+bool usteer_parse_macaddr(struct blob_attr *attr, uint8_t *addr);
+enum usteer_event_handler usteer_event_lookup(const char *method, enum usteer_event_type *type);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Replays hostapd notifications through the front end of the event handler:
+ * method lookup, event clock and station address parsing. blobmsg_parse()
+ * is the same in both variants, it runs once per event while loading.
+ *
+ * Input is recorded "ubus subscribe hostapd.<ifname>" output, one
+ * { "<method>": { ... } } object per line. Without a file, a synthetic mix
+ * of about 75% probe requests plus auth, assoc and beacon-report events from 64
+ * addresses is used.
+ *
+ * "legacy" is the front end before the lookup table and the coarse clock,
+ * "current" is the one in event.c.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <net/ethernet.h>
+#include <netinet/ether.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libubox/blobmsg_json.h>
+
+#include "usteer.h"
+#include "event.h"
+
+struct bench_event {
+	const char *method;
+	struct blob_attr *msg;
+	struct blob_attr *addr;
+};
+
+enum {
+	EVENT_ADDR,
+	EVENT_SIGNAL,
+	EVENT_TARGET,
+	EVENT_FREQ,
+	__EVENT_MAX
+};
+
+static const struct blobmsg_policy event_policy[__EVENT_MAX] = {
+	[EVENT_ADDR] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
+	[EVENT_SIGNAL] = { .name = "signal", .type = BLOBMSG_TYPE_INT32 },
+	[EVENT_TARGET] = { .name = "target", .type = BLOBMSG_TYPE_STRING },
+	[EVENT_FREQ] = { .name = "freq", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static struct bench_event *events;
+static unsigned int n_events, max_events;
+static struct blob_buf b;
+
+/* keeps the results alive so the compiler can't drop the work */
+static volatile uint64_t sink;
+
+static uint64_t bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_add_event(const char *method, struct blob_attr *msg)
+{
+	struct blob_attr *tb[__EVENT_MAX];
+	struct bench_event *ev;
+
+	if (n_events == max_events) {
+		max_events = max_events ? 2 * max_events : 1024;
+		events = realloc(events, max_events * sizeof(*events));
+		if (!events) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	ev = &events[n_events++];
+	ev->method = strdup(method);
+	ev->msg = blob_memdup(msg);
+	blobmsg_parse(event_policy, __EVENT_MAX, tb, blobmsg_data(ev->msg),
+		      blobmsg_data_len(ev->msg));
+	ev->addr = tb[EVENT_ADDR];
+}
+
+static int bench_load(const char *file)
+{
+	struct blob_attr *cur;
+	size_t len = 0;
+	char *line = NULL;
+	FILE *f;
+	int rem;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	while (getline(&line, &len, f) > 0) {
+		blob_buf_init(&b, 0);
+		if (!blobmsg_add_json_from_string(&b, line))
+			continue;
+
+		blob_for_each_attr(cur, b.head, rem) {
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+				continue;
+
+			bench_add_event(blobmsg_name(cur), cur);
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return 0;
+}
+
+static void bench_generate(unsigned int count)
+{
+	static const char * const mix[8] = {
+		"probe", "probe", "probe", "probe", "probe", "probe",
+		"auth", "assoc",
+	};
+	char addr[18];
+	unsigned int i;
+	void *c;
+
+	for (i = 0; i < count; i++) {
+		const char *method = mix[i % ARRAY_SIZE(mix)];
+
+		/* one probe in 64 events becomes a beacon report */
+		if (i % 64 == 8)
+			method = "beacon-report";
+
+		snprintf(addr, sizeof(addr), "02:00:00:00:%02x:%02x",
+			 (i * 37) % 64 / 16, (i * 37) % 16);
+
+		blob_buf_init(&b, 0);
+		c = blobmsg_open_table(&b, method);
+		blobmsg_add_string(&b, "address", addr);
+		blobmsg_add_u32(&b, "signal", -40 - (i % 50));
+		blobmsg_add_u32(&b, "freq", i & 1 ? 5180 : 2412);
+		blobmsg_close_table(&b, c);
+
+		bench_add_event(method, blob_data(b.head));
+	}
+}
+
+/* strcmp over every event name, ether_aton() and CLOCK_MONOTONIC */
+static uint64_t bench_legacy(struct bench_event *ev)
+{
+	enum usteer_event_type ev_type = __EVENT_TYPE_MAX;
+	const uint8_t *addr;
+	struct timespec ts;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	for (i = 0; i < ARRAY_SIZE(event_types); i++) {
+		if (strcmp(ev->method, event_types[i]) != 0)
+			continue;
+
+		ev_type = i;
+		break;
+	}
+
+	if (ev_type == EVENT_TYPE_BEACON)
+		return ts.tv_nsec;
+
+	if (!strcmp(ev->method, "bss-transition-response"))
+		return ts.tv_nsec;
+
+	if (!ev->addr)
+		return ts.tv_nsec;
+
+	addr = (uint8_t *) ether_aton(blobmsg_data(ev->addr));
+	if (!addr)
+		return ts.tv_nsec;
+
+	return ts.tv_nsec + ev_type + addr[5];
+}
+
+/* usteer_event_lookup(), usteer_parse_macaddr() and CLOCK_MONOTONIC_COARSE */
+static uint64_t bench_current(struct bench_event *ev)
+{
+	enum usteer_event_type ev_type = __EVENT_TYPE_MAX;
+	struct timespec ts;
+	uint8_t addr[6];
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	if (usteer_event_lookup(ev->method, &ev_type) != EVENT_HANDLER_STA)
+		return ts.tv_nsec;
+
+	if (!ev->addr || !usteer_parse_macaddr(ev->addr, addr))
+		return ts.tv_nsec;
+
+	return ts.tv_nsec + ev_type + addr[5];
+}
+
+static void bench_run(const char *name, uint64_t (*cb)(struct bench_event *ev),
+		      unsigned int total)
+{
+	uint64_t start, elapsed, sum = 0;
+	unsigned int i;
+
+	start = bench_time();
+	for (i = 0; i < total; i++)
+		sum += cb(&events[i % n_events]);
+	elapsed = bench_time() - start;
+	sink += sum;
+
+	if (!elapsed)
+		elapsed = 1;
+
+	printf("%-8s %u events in %.3f s: %.1f M events/s, %.1f ns/event\n",
+	       name, total, elapsed / 1e9, total * 1e3 / elapsed,
+	       (double) elapsed / total);
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] [<file>]\n"
+		"Options:\n"
+		" -n <count>:   Number of events to replay (default: 20000000)\n"
+		" -r <rounds>:  Number of runs of each variant (default: 3)\n"
+		"\n", prog);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int total = 20000000;
+	unsigned int rounds = 3;
+	unsigned int i;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:r:")) != -1) {
+		switch (ch) {
+		case 'n':
+			total = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (optind < argc) {
+		if (bench_load(argv[optind]))
+			return 1;
+	} else {
+		bench_generate(1024);
+	}
+
+	if (!n_events || !total) {
+		fprintf(stderr, "No events to replay\n");
+		return 1;
+	}
+
+	printf("Replaying %u events, %u recorded\n", total, n_events);
+	for (i = 0; i < rounds; i++) {
+		bench_run("legacy", bench_legacy, total);
+		bench_run("current", bench_current, total);
+	}
+
+	return 0;
+}
@@ -30,8 +30,30 @@
 #include "node.h"
 #include "usteer.h"
 #include "hearing_map.h"
+#include "rf_graph.h"
+#include "metrics.h"
+#include "mem.h"
 
-static struct blob_buf b;
+USTEER_BLOB_BUF(b, "hearing_map")
+
+static const char * const beacon_modes[] = {
+	"passive", "active", "table"
+};
+
+USTEER_COUNTER_VEC(m_beacon_requests, "beacon_requests_total",
+		   "Beacon requests sent to clients", "mode",
+		   beacon_modes, ARRAY_SIZE(beacon_modes));
+USTEER_COUNTER(m_beacon_deferred, "beacon_requests_deferred_total",
+	       "Due beacon requests deferred by beacon_request_rate");
+USTEER_COUNTER(m_beacon_downgraded, "beacon_requests_downgraded_total",
+	       "Active beacon requests sent as passive on a congested radio");
+USTEER_COUNTER(m_beacon_reports, "beacon_reports_total",
+	       "Beacon reports received from local clients");
+USTEER_COUNTER(m_beacon_merged, "beacon_reports_merged_total",
+	       "Beacon reports taken over from remote hearing maps");
+USTEER_HISTOGRAM(m_beacon_rcpi, "beacon_report_rcpi",
+		 "RCPI of received beacon reports",
+		 40, 60, 80, 100, 120, 140, 160);
 
 struct usteer_node*
 get_usteer_node_from_bssid(uint8_t *bssid)
@@ -50,27 +72,107 @@ get_usteer_node_from_bssid(uint8_t *bssid)
 	return NULL;
 }
 
-static inline void
-usteer_beacon_report_free(struct beacon_report *br)
+bool
+usteer_beacon_report_expired(struct beacon_report *br)
 {
-	list_del(&br->sta_list);
-	free(br);
+	return current_time - br->usteer_time >
+	       (uint64_t) config.beacon_report_invalide_timeout * 1000;
 }
 
-static bool
-usteer_beacon_report_delete(struct beacon_report *br, uint8_t *bssid)
+/* drop expired reports, keeps the array sorted */
+void
+usteer_beacon_report_expire(struct sta_info *si)
+{
+	struct sta_info_ext *ext = si->ext;
+	int i, n = 0;
+
+	for (i = 0; i < ext->n_beacon_reports; i++) {
+		if (usteer_beacon_report_expired(&ext->beacon_reports[i]))
+			continue;
+
+		if (n != i)
+			ext->beacon_reports[n] = ext->beacon_reports[i];
+		n++;
+	}
+	ext->n_beacon_reports = n;
+}
+
+/*
+ * Insert or update the report of a bssid in place, keeping the array sorted
+ * by RCPI (best first). When full, the weakest report gives way, except for
+ * the one of the client's current node, which candidates are compared with.
+ */
+static void
+usteer_beacon_report_add(struct sta_info *si, struct beacon_report *new)
 {
-	if (bssid && memcmp(br->bssid, bssid, 6) == 0) {
-		usteer_beacon_report_free(br);
-		return true;
+	struct sta_info_ext *ext = si->ext;
+	struct beacon_report *reports = ext->beacon_reports;
+	const uint8_t *cur = si->node->bssid;
+	int i;
+
+	for (i = 0; i < ext->n_beacon_reports; i++)
+		if (!memcmp(reports[i].bssid, new->bssid, sizeof(new->bssid)))
+			break;
+
+	if (i == ext->n_beacon_reports) {
+		usteer_beacon_report_expire(si);
+		i = ext->n_beacon_reports;
+		if (i < STA_BEACON_REPORTS) {
+			ext->n_beacon_reports++;
+		} else {
+			do {
+				i--;
+			} while (!memcmp(reports[i].bssid, cur, sizeof(reports[i].bssid)));
+
+			if (reports[i].rcpi > new->rcpi &&
+			    memcmp(new->bssid, cur, sizeof(new->bssid)) != 0)
+				return;
+		}
+	}
+
+	while (i > 0 && reports[i - 1].rcpi < new->rcpi) {
+		reports[i] = reports[i - 1];
+		i--;
 	}
-	uint64_t time_diff = current_time - br->usteer_time;
-	uint64_t time_diff_conf = config.beacon_report_invalide_timeout * 1000;
-	if (time_diff_conf < time_diff) {
-		usteer_beacon_report_free(br);
-		return true;
+	while (i < ext->n_beacon_reports - 1 && reports[i + 1].rcpi > new->rcpi) {
+		reports[i] = reports[i + 1];
+		i++;
+	}
+	reports[i] = *new;
+}
+
+/*
+ * Merge a report received from a remote node into the hearing maps of the
+ * local nodes that know the station. Reports of the client's own scans
+ * are the same no matter which node asked, newer entries win.
+ */
+void
+usteer_beacon_report_merge(struct sta *sta, struct beacon_report *new)
+{
+	struct sta_info_ext *ext;
+	struct sta_info *si;
+	int i;
+
+	if (usteer_beacon_report_expired(new) ||
+	    !get_usteer_node_from_bssid(new->bssid))
+		return;
+
+	list_for_each_entry(si, &sta->nodes, list) {
+		ext = si->ext;
+		if (!ext)
+			continue;
+
+		for (i = 0; i < ext->n_beacon_reports; i++)
+			if (!memcmp(ext->beacon_reports[i].bssid, new->bssid, sizeof(new->bssid)))
+				break;
+
+		if (i < ext->n_beacon_reports &&
+		    ext->beacon_reports[i].usteer_time >= new->usteer_time)
+			continue;
+
+		usteer_beacon_report_add(si, new);
+		usteer_metric_inc(&m_beacon_merged);
 	}
-	return false;
 }
 
 void usteer_ubus_hearing_map(struct blob_buf *bm, struct sta_info *si) 
@@ -79,7 +181,11 @@ void usteer_ubus_hearing_map(struct blob_buf *bm, struct sta_info *si)
 	void *_hm, *_nr;
 
 	_hm = blobmsg_open_table(bm, "hearing_map");
-	list_for_each_entry(br, &si->beacon_reports, sta_list) {
+	for (br = si->ext->beacon_reports;
+	     br < &si->ext->beacon_reports[si->ext->n_beacon_reports]; br++) {
+		if (usteer_beacon_report_expired(br))
+			continue;
+
 		_nr = blobmsg_open_table(bm, ether_ntoa((struct ether_addr *) br->bssid));
 		struct usteer_node *node = get_usteer_node_from_bssid(br->bssid);
 		if (node)
@@ -170,18 +276,22 @@ static const struct blobmsg_policy beacon_rep_policy[__BEACON_REP_MAX] = {
 	[BEACON_REP_RSNI] = {.name = "rsni", .type = BLOBMSG_TYPE_INT16},
 };
 
+/* does not touch the request state, the caller commits *failed when sending */
 static uint8_t
-usteer_get_beacon_request_mode(struct sta_info *si, int freq)
+usteer_get_beacon_request_mode(struct sta_info *si, int freq, uint8_t *failed)
 {
-	struct beacon_request *br = &si->beacon_request;
+	struct beacon_request *br = &si->ext->beacon_request;
+	int failed_requests = br->failed_requests;
+
 	if (si->node->freq == freq) {
 		long time_diff = br->lastReportTime - br->lastRequestTime;
 		if (0 < time_diff)
-			br->failed_requests /= 2;
-		br->failed_requests++;
+			failed_requests /= 2;
+		if (failed_requests < UINT8_MAX)
+			failed_requests++;
 	}
+	*failed = failed_requests;
 
-	int failed_requests = br->failed_requests;
 	if (freq < 4000) {
 		if (failed_requests < 3)
 			return 1;
@@ -194,6 +304,41 @@ usteer_get_beacon_request_mode(struct sta_info *si, int freq)
 	return 2;
 }
 
+/* hostapd beacon request modes (passive, active, table) */
+static const enum usteer_sta_cap beacon_mode_caps[] = {
+	STA_CAP_BEACON_PASSIVE,
+	STA_CAP_BEACON_ACTIVE,
+	STA_CAP_BEACON_TABLE,
+};
+
+/* stick to the preferred mode if the client supports it, -1 if it supports none */
+static int
+usteer_beacon_request_supported_mode(struct sta *sta, int mode)
+{
+	int i;
+
+	if (usteer_sta_has_cap(sta, beacon_mode_caps[mode]))
+		return mode;
+
+	for (i = 0; i < ARRAY_SIZE(beacon_mode_caps); i++)
+		if (usteer_sta_has_cap(sta, beacon_mode_caps[i]))
+			return i;
+
+	return -1;
+}
+
+/*
+ * false for clients that do not support beacon reports, or have not answered
+ * any of the last BEACON_REQUEST_MAX_FAILED requests
+ */
+bool usteer_sta_info_beacon_capable(struct sta_info *si)
+{
+	if (usteer_beacon_request_supported_mode(si->sta, 0) < 0)
+		return false;
+
+	return si->ext->beacon_request.failed_requests < BEACON_REQUEST_MAX_FAILED;
+}
+
 static inline int
 usteer_beacon_request_next_band(struct sta_info *si, int freq)
 {
@@ -217,51 +362,175 @@ usteer_beacon_request_next_band(struct sta_info *si, int freq)
 	return node->freq;
 }
 
-void usteer_beacon_request_check(struct sta_info *si) 
+static bool
+usteer_beacon_report_stale(struct sta_info *si)
 {
-	struct beacon_request *br = &si->beacon_request;
+	struct beacon_report *br;
+
+	for (br = si->ext->beacon_reports;
+	     br < &si->ext->beacon_reports[si->ext->n_beacon_reports]; br++) {
+		if (!memcmp(br->bssid, si->node->bssid, sizeof(br->bssid)))
+			return usteer_beacon_report_expired(br);
+	}
+
+	return true;
+}
+
+/* 0 if no request is due, otherwise higher values are served first */
+static uint32_t
+usteer_beacon_request_priority(struct sta_info *si)
+{
+	struct beacon_request *br = &si->ext->beacon_request;
 	struct usteer_node *node = si->node;
-	uint64_t ctime = current_time;
-	int freq = br->band;
+	int64_t age = current_time - br->lastRequestTime;
+	int64_t dyn_freq;
+	uint64_t priority;
+
+	if (usteer_beacon_request_supported_mode(si->sta, 0) < 0)
+		return 0;
+
+	/*
+	 * A multi-band scan row is still in progress (it ends when band has
+	 * cycled back to the node's frequency), finish it before anything else.
+	 * This is unrelated to the roam state, stations close to roaming only
+	 * get the boost below.
+	 */
+	if (br->band != node->freq)
+		return UINT32_MAX;
 
 	/*
 	 * based on the current reception, determine a the frequency beacon requests are sent.
 	 * Adjust signal range from (-90 to -30) to (-30 to 30)
 	 * */
 	float adj_signal = (float) (si->signal + 60);
-	float dyn_freq = config.beacon_request_frequency +
-					 (config.beacon_request_signal_modifier * (adj_signal / (1 + abs(adj_signal))));
-	if (freq == node->freq && ctime - br->lastRequestTime < dyn_freq)
-		return;
+	dyn_freq = config.beacon_request_frequency +
+		   (int64_t) (config.beacon_request_signal_modifier * (adj_signal / (1 + abs(adj_signal))));
+	/* keep probing unresponsive clients now and then, they may answer again */
+	if (br->failed_requests >= BEACON_REQUEST_MAX_FAILED)
+		dyn_freq *= 4;
+	if (age < dyn_freq)
+		return 0;
+
+	/* a station never asked before has the full uptime as age */
+	priority = age - dyn_freq + 1;
+	if (usteer_sta_info_near_roam(si))
+		priority += config.beacon_request_frequency;
+	if (usteer_beacon_report_stale(si))
+		priority += config.beacon_request_frequency / 2;
+
+	/* UINT32_MAX is reserved for scan rows */
+	if (priority >= UINT32_MAX)
+		priority = UINT32_MAX - 1;
 
-	uint8_t mode = usteer_get_beacon_request_mode(si, freq); // run before lastRequestTime is renewed
+	return priority;
+}
+
+static bool
+usteer_beacon_request_run(struct usteer_local_node *ln, struct sta_info *si)
+{
+	struct beacon_request *br = &si->ext->beacon_request;
+	struct usteer_node *node = si->node;
+	int freq = br->band;
+	uint8_t failed;
+	int mode;
+
+	mode = usteer_get_beacon_request_mode(si, freq, &failed); // run before lastRequestTime is renewed
+
+	/* active scans make the client probe on every channel, avoid on a busy radio */
+	if (mode == 1 && usteer_node_congested(node) &&
+	    usteer_sta_has_cap(si->sta, STA_CAP_BEACON_PASSIVE)) {
+		ln->beacon_req.downgraded++;
+		usteer_metric_inc(&m_beacon_downgraded);
+		mode = 0;
+	}
+
+	mode = usteer_beacon_request_supported_mode(si->sta, mode);
+
+	/* table mode is answered from the client's scan cache, no airtime spent on scanning */
+	if (mode != 2 && config.beacon_request_rate &&
+	    !usteer_token_bucket_take(&ln->beacon_req.tb, config.beacon_request_rate,
+				      config.beacon_request_burst))
+		return false;
+
+	br->failed_requests = failed;
 	usteer_beacon_request_send(si, freq, mode);
+	ln->beacon_req.sent++;
+	usteer_metric_inc_idx(&m_beacon_requests, mode);
 
 	/* do only once in a scan row (multiple bands) */
 	if (br->band == node->freq) {
-		br->lastRequestTime = ctime;
-		uint8_t bssid[6];
-		memset(bssid, 255, 6); // FF:FF:FF:FF:FF:FF should be a invalid bssid
-		usteer_beacon_report_cleanup(si, bssid);
+		br->lastRequestTime = current_time;
+		usteer_beacon_report_expire(si);
 	}
 
 	/* select next band for scanning */
 	br->band = usteer_beacon_request_next_band(si, freq);
+
+	return true;
 }
 
-void usteer_beacon_report_cleanup(struct sta_info *si, uint8_t *bssid) 
+static int
+usteer_beacon_request_cmp(const void *a, const void *b)
 {
-	struct beacon_report *br, *tmp;
-	list_for_each_entry_safe(br, tmp, &si->beacon_reports, sta_list)
-		bssid ? usteer_beacon_report_delete(br, bssid)
-		      : usteer_beacon_report_free(br);
+	const struct sta_info *sa = *(struct sta_info * const *) a;
+	const struct sta_info *sb = *(struct sta_info * const *) b;
+	uint32_t pa = sa->ext->beacon_request.priority;
+	uint32_t pb = sb->ext->beacon_request.priority;
+
+	if (pa != pb)
+		return pa > pb ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * Serve due beacon requests of a radio in priority order, limited by its
+ * token bucket. Stations that do not get a token stay due for the next run,
+ * the ones after them may still send table mode requests, which need none.
+ */
+void usteer_beacon_request_schedule(struct usteer_local_node *ln)
+{
+	struct sta_info *si, **queue;
+	uint32_t queued = 0, deferred = 0;
+	int i, n = 0;
+
+	list_for_each_entry(si, &ln->node.sta_info, node_list) {
+		struct beacon_request *br = &si->ext->beacon_request;
+
+		br->priority = si->connected == 1 ? usteer_beacon_request_priority(si) : 0;
+		if (br->priority)
+			queued++;
+	}
+
+	ln->beacon_req.queued = queued;
+	if (!queued)
+		return;
+
+	queue = alloca(queued * sizeof(*queue));
+	list_for_each_entry(si, &ln->node.sta_info, node_list)
+		if (si->ext->beacon_request.priority)
+			queue[n++] = si;
+
+	qsort(queue, n, sizeof(*queue), usteer_beacon_request_cmp);
+
+	for (i = 0; i < n; i++) {
+		if (!usteer_beacon_request_run(ln, queue[i])) {
+			deferred++;
+			continue;
+		}
+
+		queue[i]->ext->beacon_request.priority = 0;
+	}
+
+	ln->beacon_req.deferred += deferred;
+	usteer_metric_add(&m_beacon_deferred, deferred);
 }
 
 void usteer_handle_event_beacon_report(struct usteer_local_node *ln, struct blob_attr *msg) 
 {
 	struct usteer_node *node = &ln->node;
 	struct blob_attr *tb[__BEACON_REP_MAX];
-	struct beacon_report *br;
+	struct beacon_report br = {};
 	struct sta_info *si;
 	struct sta *sta;
 
@@ -281,18 +550,18 @@ void usteer_handle_event_beacon_report(struct usteer_local_node *ln, struct blob
 	if(!get_usteer_node_from_bssid(addr))
 		return;
 
-	br = malloc(sizeof(struct beacon_report));
-	br->address = si;
-	memcpy(br->bssid, addr, sizeof(br->bssid));
-	br->rcpi = blobmsg_get_u16(tb[BEACON_REP_RCPI]);
-	br->rsni = blobmsg_get_u16(tb[BEACON_REP_RSNI]);
-	br->op_class = blobmsg_get_u16(tb[BEACON_REP_OP_CLASS]);
-	br->channel = blobmsg_get_u16(tb[BEACON_REP_CHANNEL]);
-	br->usteer_time = current_time; // beacon_report_invalide_timeout
-	si->beacon_request.lastReportTime = br->usteer_time;
+	memcpy(br.bssid, addr, sizeof(br.bssid));
+	br.rcpi = blobmsg_get_u16(tb[BEACON_REP_RCPI]);
+	br.rsni = blobmsg_get_u16(tb[BEACON_REP_RSNI]);
+	br.op_class = blobmsg_get_u16(tb[BEACON_REP_OP_CLASS]);
+	br.channel = blobmsg_get_u16(tb[BEACON_REP_CHANNEL]);
+	br.usteer_time = current_time; // beacon_report_invalide_timeout
+	si->ext->beacon_request.lastReportTime = br.usteer_time;
 
 	MSG(DEBUG, "received beacon-report {op-class=%d, channel=%d, rcpi=%d, rsni=%d, bssid=%s} on %s from %s",
-		br->op_class, br->channel, br->rcpi, br->rsni, bssid, ln->iface, address);
-	usteer_beacon_report_cleanup(si, br->bssid);
-	list_add(&br->sta_list, &si->beacon_reports);
+		br.op_class, br.channel, br.rcpi, br.rsni, bssid, ln->iface, address);
+	usteer_metric_inc(&m_beacon_reports);
+	usteer_metric_observe(&m_beacon_rcpi, br.rcpi);
+	usteer_rf_graph_beacon_report(si, &br);
+	usteer_beacon_report_add(si, &br);
 }
\ No newline at end of file
@@ -36,11 +36,101 @@
 #include "usteer.h"
 #include "node.h"
 #include "hearing_map.h"
+#include "rf_graph.h"
+#include "metrics.h"
+#include "event.h"
+#include "trace.h"
+#include "probe.h"
+#include "profile.h"
+#include "mem.h"
 
 AVL_TREE(local_nodes, avl_strcmp, false, NULL);
-static struct blob_buf b;
+USTEER_BLOB_BUF(b, "local_node")
 static char *node_up_script;
 
+/* indexed by local_req_state - 1 */
+static const char * const local_req_methods[__REQ_MAX - 1] = {
+	"get_clients", "rrm_nr_set", "rrm_nr_get_own"
+};
+
+static int64_t usteer_local_node_count(unsigned int idx)
+{
+	return local_nodes.count;
+}
+
+static int64_t usteer_rrm_nr_average_entries(unsigned int idx)
+{
+	struct usteer_local_node *ln;
+	int64_t entries = 0;
+
+	if (!local_nodes.count)
+		return 0;
+
+	avl_for_each_element(&local_nodes, ln, node.avl)
+		entries += ln->rrm_nr.entries;
+
+	return entries / local_nodes.count;
+}
+
+/* population of the clients connected to local nodes */
+static int64_t usteer_sta_caps_count(unsigned int idx, bool known)
+{
+	struct usteer_local_node *ln;
+	struct sta_info *si;
+	int64_t n = 0;
+
+	avl_for_each_element(&local_nodes, ln, node.avl) {
+		list_for_each_entry(si, &ln->node.sta_info, node_list) {
+			if (si->connected != 1)
+				continue;
+
+			if (!(si->sta->caps_known & (1 << idx)))
+				n += !known;
+			else if (si->sta->caps & (1 << idx))
+				n += known;
+		}
+	}
+
+	return n;
+}
+
+static int64_t usteer_sta_caps_supported(unsigned int idx)
+{
+	return usteer_sta_caps_count(idx, true);
+}
+
+static int64_t usteer_sta_caps_unknown(unsigned int idx)
+{
+	return usteer_sta_caps_count(idx, false);
+}
+
+USTEER_GAUGE_FN(m_local_nodes, "local_nodes", "Local nodes", usteer_local_node_count);
+USTEER_COUNTER_VEC(m_events, "events_total", "Notifications received from hostapd",
+		   "type", hostapd_events, __HOSTAPD_EVENT_MAX);
+USTEER_COUNTER(m_events_unknown, "events_unknown_total",
+	       "Notifications from hostapd without a handler");
+USTEER_COUNTER(m_events_invalid, "events_invalid_total",
+	       "Station events with missing or malformed fields");
+USTEER_COUNTER(m_events_rejected, "events_rejected_total",
+	       "Station events answered with a refusal");
+USTEER_COUNTER_VEC(m_hostapd_requests, "hostapd_requests_total",
+		   "Periodic requests sent to hostapd", "method",
+		   local_req_methods, __REQ_MAX - 1);
+USTEER_COUNTER_VEC(m_hostapd_errors, "hostapd_request_errors_total",
+		   "Periodic hostapd requests that failed", "method",
+		   local_req_methods, __REQ_MAX - 1);
+USTEER_COUNTER(m_rrm_nr_pushed, "neighbor_report_pushed_total",
+	       "Neighbor lists pushed to hostapd");
+USTEER_GAUGE_FN(m_rrm_nr_entries, "neighbor_report_entries",
+		"Average number of entries in the neighbor list of the local nodes",
+		usteer_rrm_nr_average_entries);
+USTEER_GAUGE_VEC_FN(m_caps_supported, "sta_caps_supported",
+		    "Connected local clients supporting a capability", "capability",
+		    sta_caps, __STA_CAP_MAX, usteer_sta_caps_supported);
+USTEER_GAUGE_VEC_FN(m_caps_unknown, "sta_caps_unknown",
+		    "Connected local clients with unknown support for a capability",
+		    "capability", sta_caps, __STA_CAP_MAX, usteer_sta_caps_unknown);
+
 static void
 usteer_local_node_state_reset(struct usteer_local_node *ln)
 {
@@ -68,7 +158,7 @@ usteer_free_node(struct ubus_context *ctx, struct usteer_local_node *ln)
 	uloop_timeout_cancel(&ln->update);
 	avl_delete(&local_nodes, &ln->node.avl);
 	ubus_unregister_subscriber(ctx, &ln->ev);
-	free(ln);
+	usteer_free(MEM_LOCAL_NODE, ln);
 }
 
 static void
@@ -80,6 +170,48 @@ usteer_handle_remove(struct ubus_context *ctx, struct ubus_subscriber *s,
 	usteer_free_node(ctx, ln);
 }
 
+static void
+usteer_handle_event_btm_response(struct usteer_local_node *ln, struct blob_attr *msg)
+{
+	enum {
+		BTM_ADDR,
+		BTM_DIALOG_TOKEN,
+		BTM_STATUS,
+		BTM_TARGET,
+		__BTM_MAX
+	};
+	static const struct blobmsg_policy policy[__BTM_MAX] = {
+		[BTM_ADDR] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
+		[BTM_DIALOG_TOKEN] = { .name = "dialog-token", .type = BLOBMSG_TYPE_INT8 },
+		[BTM_STATUS] = { .name = "status-code", .type = BLOBMSG_TYPE_INT8 },
+		[BTM_TARGET] = { .name = "target-bssid", .type = BLOBMSG_TYPE_STRING },
+	};
+	struct blob_attr *tb[__BTM_MAX];
+	uint8_t addr[6], target[6];
+	bool have_target;
+	struct sta_info *si;
+	struct sta *sta;
+
+	blobmsg_parse(policy, __BTM_MAX, tb, blob_data(msg), blob_len(msg));
+	if (!tb[BTM_ADDR] || !tb[BTM_DIALOG_TOKEN] || !tb[BTM_STATUS])
+		return;
+
+	if (!usteer_parse_macaddr(tb[BTM_ADDR], addr))
+		return;
+
+	sta = usteer_sta_get(addr, false);
+	if (!sta)
+		return;
+
+	si = usteer_sta_info_get(sta, &ln->node, NULL);
+	if (!si)
+		return;
+
+	have_target = tb[BTM_TARGET] && usteer_parse_macaddr(tb[BTM_TARGET], target);
+	usteer_roam_btm_response(si, blobmsg_get_u8(tb[BTM_DIALOG_TOKEN]),
+				 blobmsg_get_u8(tb[BTM_STATUS]), have_target ? target : NULL);
+}
+
 static int
 usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 		            struct ubus_request_data *req, const char *method,
@@ -92,7 +224,7 @@ usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 		EVENT_FREQ,
 		__EVENT_MAX
 	};
-	struct blobmsg_policy policy[__EVENT_MAX] = {
+	static const struct blobmsg_policy policy[__EVENT_MAX] = {
 		[EVENT_ADDR] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
 		[EVENT_SIGNAL] = { .name = "signal", .type = BLOBMSG_TYPE_INT32 },
 		[EVENT_TARGET] = { .name = "target", .type = BLOBMSG_TYPE_STRING },
@@ -104,32 +236,38 @@ usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 	struct usteer_node *node;
 	int signal = NO_SIGNAL;
 	int freq = 0;
-	const char *addr_str;
-	const uint8_t *addr;
-	int i;
+	uint8_t addr[6];
+	uint64_t start;
 	bool ret;
 
-	usteer_update_time();
-
-	for (i = 0; i < ARRAY_SIZE(event_types); i++) {
-		if (strcmp(method, event_types[i]) != 0)
-			continue;
-
-		ev_type = i;
-		break;
-	}
+	start = usteer_probe_time();
+	usteer_update_time_coarse();
 
 	ln = container_of(obj, struct usteer_local_node, ev.obj);
 	node = &ln->node;
 
-	if (ev_type == EVENT_TYPE_BEACON) {
+	switch (usteer_event_lookup(method, &ev_type)) {
+	case EVENT_HANDLER_STA:
+		break;
+	case EVENT_HANDLER_BEACON:
+		usteer_metric_inc_idx(&m_events, ev_type);
 		usteer_handle_event_beacon_report(ln, msg);
 		return 0;
+	case EVENT_HANDLER_BTM:
+		usteer_metric_inc_idx(&m_events, HOSTAPD_EVENT_BTM_RESPONSE);
+		usteer_handle_event_btm_response(ln, msg);
+		return 0;
+	case EVENT_HANDLER_UNKNOWN:
+		usteer_metric_inc(&m_events_unknown);
+		return 0;
 	}
 
+	usteer_metric_inc_idx(&m_events, ev_type);
 	blobmsg_parse(policy, __EVENT_MAX, tb, blob_data(msg), blob_len(msg));
-	if (!tb[EVENT_ADDR] || !tb[EVENT_FREQ])
+	if (!tb[EVENT_ADDR] || !tb[EVENT_FREQ]) {
+		usteer_metric_inc(&m_events_invalid);
 		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
 
 	if (tb[EVENT_SIGNAL])
 		signal = (int32_t) blobmsg_get_u32(tb[EVENT_SIGNAL]);
@@ -137,34 +275,113 @@ usteer_handle_event(struct ubus_context *ctx, struct ubus_object *obj,
 	if (tb[EVENT_FREQ])
 		freq = blobmsg_get_u32(tb[EVENT_FREQ]);
 
-	addr_str = blobmsg_data(tb[EVENT_ADDR]);
-	addr = (uint8_t *) ether_aton(addr_str);
-	if (!addr)
+	if (!usteer_parse_macaddr(tb[EVENT_ADDR], addr)) {
+		usteer_metric_inc(&m_events_invalid);
 		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
 
+	USTEER_PROBE(sta_event, addr, usteer_node_name(node), ev_type, freq, signal);
 	ret = usteer_handle_sta_event(node, addr, ev_type, freq, signal);
+	USTEER_PROBE(sta_verdict, addr, usteer_node_name(node), ev_type, ret,
+		     usteer_probe_time() - start);
+	TRACE_ADDR(STA_EVENT, addr, ev_type, freq, signal, ret);
+	if (!ret)
+		usteer_metric_inc(&m_events_rejected);
 
-	MSG(DEBUG, "received %s event from %s, signal=%d, freq=%d, handled:%s\n",
-	    method, addr_str, signal, freq, ret ? "true" : "false");
+	MSG(DEBUG, "received %s event from "MAC_ADDR_FMT", signal=%d, freq=%d, handled:%s\n",
+	    method, MAC_ADDR_DATA(addr), signal, freq, ret ? "true" : "false");
 
 	return ret ? 0 : 17 /* WLAN_STATUS_AP_UNABLE_TO_HANDLE_NEW_STA */;
 }
 
+USTEER_PROFILE_UBUS_HANDLER(HOSTAPD_EVENT, usteer_handle_event)
+
+/* byte <idx> of an element hostapd reports as an array of integers, 0 past its end */
+static uint8_t
+usteer_ie_byte(struct blob_attr *attr, int idx)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		if (idx--)
+			continue;
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_INT32)
+			return 0;
+
+		return blobmsg_get_u32(cur);
+	}
+
+	return 0;
+}
+
+static void
+usteer_local_node_caps_update(struct sta *sta, struct blob_attr *rrm,
+			      struct blob_attr *ext_capa)
+{
+	uint8_t caps = sta->caps, known = sta->caps_known;
+	uint8_t val;
+
+	if (rrm) {
+		/* RRM Enabled Capabilities element, first octet */
+		val = usteer_ie_byte(rrm, 0);
+		known |= (1 << STA_CAP_NEIGHBOR_REPORT) | (1 << STA_CAP_BEACON_PASSIVE) |
+			 (1 << STA_CAP_BEACON_ACTIVE) | (1 << STA_CAP_BEACON_TABLE);
+		caps &= ~known;
+		if (val & (1 << 1))
+			caps |= 1 << STA_CAP_NEIGHBOR_REPORT;
+		if (val & (1 << 4))
+			caps |= 1 << STA_CAP_BEACON_PASSIVE;
+		if (val & (1 << 5))
+			caps |= 1 << STA_CAP_BEACON_ACTIVE;
+		if (val & (1 << 6))
+			caps |= 1 << STA_CAP_BEACON_TABLE;
+	}
+
+	if (ext_capa) {
+		/* Extended Capabilities element, bit 19: BSS Transition */
+		val = usteer_ie_byte(ext_capa, 2);
+		known |= 1 << STA_CAP_BTM;
+		caps &= ~(1 << STA_CAP_BTM);
+		if (val & (1 << 3))
+			caps |= 1 << STA_CAP_BTM;
+	}
+
+	if (caps == sta->caps && known == sta->caps_known)
+		return;
+
+	MSG(VERBOSE, "station "MAC_ADDR_FMT" capabilities 0x%02x (known 0x%02x)\n",
+	    MAC_ADDR_DATA(sta->addr), caps, known);
+	sta->caps = caps;
+	sta->caps_known = known;
+}
+
 static void
 usteer_local_node_assoc_update(struct sta_info *si, struct blob_attr *data)
 {
 	enum {
 		MSG_ASSOC,
+		MSG_RRM,
+		MSG_EXT_CAPA,
 		__MSG_MAX,
 	};
 	static struct blobmsg_policy policy[__MSG_MAX] = {
 		[MSG_ASSOC] = { "assoc", BLOBMSG_TYPE_BOOL },
+		[MSG_RRM] = { "rrm", BLOBMSG_TYPE_ARRAY },
+		[MSG_EXT_CAPA] = { "extended_capabilities", BLOBMSG_TYPE_ARRAY },
 	};
 	struct blob_attr *tb[__MSG_MAX];
 
 	blobmsg_parse(policy, __MSG_MAX, tb, blobmsg_data(data), blobmsg_data_len(data));
-	if (tb[MSG_ASSOC] && blobmsg_get_u8(tb[MSG_ASSOC]))
+	if (tb[MSG_ASSOC] && blobmsg_get_u8(tb[MSG_ASSOC])) {
+		/* capabilities only change with a (re)association */
+		if (!si->connected || !si->sta->caps_known)
+			usteer_local_node_caps_update(si->sta, tb[MSG_RRM], tb[MSG_EXT_CAPA]);
+		if (!si->connected)
+			usteer_sta_info_assoc(si);
 		si->connected = 1;
+	}
 
 	if (si->node->freq < 4000)
 		si->sta->seen_2ghz = 1;
@@ -189,12 +406,13 @@ usteer_update_client_active_bytes(struct sta_info *si, struct blob_attr *data)
 			[MSG_RX] = { "rx", BLOBMSG_TYPE_INT64 },
 			[MSG_TX] = { "tx", BLOBMSG_TYPE_INT64 },
 	};
-	struct sta_active_bytes active_bytes = si->active_bytes;
+	struct sta_active_bytes *ab = &si->ext->active_bytes;
 	struct blob_attr *tb_bytes[__MSG_MAX_BYTES];
 	struct blob_attr *tb_rxtx[__MSG_MAX_RXTX];
-	uint64_t ctime = current_time;
+	uint64_t interval;
 
-	if (ctime - active_bytes.last_time < config.kick_client_active_sec * 1000)
+	interval = config.kick_client_active_sec * 1000 / (STA_ACTIVE_SAMPLES - 1);
+	if (ab->count && current_time - ab->samples[ab->head].time < interval)
 		return;
 
 	blobmsg_parse(policy_bytes, __MSG_MAX_BYTES, tb_bytes, blobmsg_data(data), blobmsg_data_len(data));
@@ -205,12 +423,8 @@ usteer_update_client_active_bytes(struct sta_info *si, struct blob_attr *data)
 	if (!tb_rxtx[MSG_RX] || !tb_rxtx[MSG_TX])
 		return;
 
-	memcpy(active_bytes.data[0], active_bytes.data[1], sizeof(active_bytes.data[1]));
-	active_bytes.data[1][0] = blobmsg_get_u64(tb_rxtx[MSG_RX]);
-	active_bytes.data[1][1] = blobmsg_get_u64(tb_rxtx[MSG_TX]);
-
-	active_bytes.last_time = ctime;
-	si->active_bytes = active_bytes;
+	usteer_sta_info_add_active_bytes(si, blobmsg_get_u64(tb_rxtx[MSG_RX]),
+					 blobmsg_get_u64(tb_rxtx[MSG_TX]));
 }
 
 static void
@@ -222,6 +436,7 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 	struct sta_info *si;
 	struct sta *sta;
 	int n_assoc = 0;
+	int airtime = 0;
 	int rem;
 
 	list_for_each_entry(si, &node->sta_info, node_list) {
@@ -245,14 +460,16 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 			h->update_sta(node, si);
 		}
 		usteer_local_node_assoc_update(si, cur);
-		if (si->connected == 1)
+		if (si->connected == 1) {
 			n_assoc++;
+			airtime += si->ext->airtime.share;
+		}
 
 		usteer_update_client_active_bytes(si, cur);
-		usteer_beacon_request_check(si);
 	}
 
 	node->n_assoc = n_assoc;
+	node->airtime = airtime > 1000 ? 100 : airtime / 10;
 
 	list_for_each_entry(si, &node->sta_info, node_list) {
 		if (si->connected != 2)
@@ -263,6 +480,8 @@ usteer_local_node_set_assoc(struct usteer_local_node *ln, struct blob_attr *cl)
 		MSG(VERBOSE, "station "MAC_ADDR_FMT" disconnected from node %s\n",
 			MAC_ADDR_DATA(si->sta->addr), usteer_node_name(node));
 	}
+
+	usteer_beacon_request_schedule(ln);
 }
 
 static void
@@ -289,9 +508,12 @@ usteer_local_node_list_cb(struct ubus_request *req, int type, struct blob_attr *
 		return;
 
 	node->freq = blobmsg_get_u32(tb[MSG_FREQ]);
+	usteer_update_time();
 	usteer_local_node_set_assoc(ln, tb[MSG_CLIENTS]);
 }
 
+USTEER_PROFILE_UBUS_DATA(HOSTAPD_CLIENTS, usteer_local_node_list_cb)
+
 static void
 usteer_local_node_rrm_nr_cb(struct ubus_request *req, int type, struct blob_attr *msg)
 {
@@ -307,7 +529,8 @@ usteer_local_node_rrm_nr_cb(struct ubus_request *req, int type, struct blob_attr
 	if (!tb)
 		return;
 
-	usteer_node_set_blob(&ln->node.rrm_nr, tb);
+	if (usteer_node_set_blob(&ln->node.rrm_nr, tb))
+		usteer_local_node_rrm_nr_dirty(NULL);
 
 	struct blobmsg_policy policy_bssid[3] = {
 			{ .type = BLOBMSG_TYPE_STRING },
@@ -327,45 +550,158 @@ usteer_local_node_rrm_nr_cb(struct ubus_request *req, int type, struct blob_attr
 	}
 }
 
+USTEER_PROFILE_UBUS_DATA(HOSTAPD_RRM_NR, usteer_local_node_rrm_nr_cb)
+
 static void
 usteer_local_node_req_cb(struct ubus_request *req, int ret)
 {
 	struct usteer_local_node *ln;
 
 	ln = container_of(req, struct usteer_local_node, req);
+	if (ret) {
+		usteer_metric_inc_idx(&m_hostapd_errors, ln->req_state - 1);
+
+		/* not applied, push the list again on the next update */
+		if (ln->req_state == REQ_RRM_SET_LIST)
+			ln->rrm_nr.valid = false;
+	}
 	uloop_timeout_set(&ln->req_timer, 1);
 }
 
-static void
-usteer_add_rrm_data(struct usteer_local_node *ln, struct usteer_node *node)
+USTEER_PROFILE_UBUS_COMPLETE(HOSTAPD_REQUEST, usteer_local_node_req_cb)
+
+struct rrm_nr_cand {
+	struct usteer_node *node;
+	uint32_t score;
+	int idx;
+};
+
+static int
+usteer_rrm_nr_cand_cmp(const void *a, const void *b)
+{
+	const struct rrm_nr_cand *ca = a, *cb = b;
+
+	if (ca->score != cb->score)
+		return ca->score > cb->score ? -1 : 1;
+
+	return ca->idx - cb->idx;
+}
+
+static bool
+usteer_rrm_nr_cand_add(struct usteer_local_node *ln, struct rrm_nr_cand *cand,
+		       int *n, struct usteer_node *node)
 {
 	if (node == &ln->node)
-		return;
+		return false;
 
 	if (!node->rrm_nr)
-		return;
+		return false;
 
 	if (strcmp(ln->node.ssid, node->ssid) != 0)
-		return;
+		return false;
 
-	blobmsg_add_field(&b, BLOBMSG_TYPE_ARRAY, "",
-			  blobmsg_data(node->rrm_nr),
-			  blobmsg_data_len(node->rrm_nr));
+	if (!usteer_rf_graph_is_neighbor(&ln->node, node))
+		return false;
+
+	if (cand) {
+		cand[*n].node = node;
+		cand[*n].score = usteer_rf_graph_score(&ln->node, node);
+		cand[*n].idx = *n;
+	}
+	(*n)++;
+
+	return true;
 }
 
-static void
+/* FNV-1a, only used to detect changes of the list */
+static uint32_t
+usteer_rrm_nr_hash(const void *data, int len)
+{
+	const uint8_t *p = data;
+	uint32_t hash = 2166136261u;
+
+	while (len-- > 0)
+		hash = (hash ^ *p++) * 16777619u;
+
+	return hash;
+}
+
+/*
+ * Mark the neighbor list of the local node with <bssid>, or of all local
+ * nodes if NULL, to be rebuilt on its next update. It depends on the rrm_nr
+ * entries of all nodes, the RF edges from the node and the config.
+ */
+void usteer_local_node_rrm_nr_dirty(const uint8_t *bssid)
+{
+	struct usteer_local_node *ln;
+
+	avl_for_each_element(&local_nodes, ln, node.avl)
+		if (!bssid || !memcmp(ln->node.bssid, bssid, sizeof(ln->node.bssid)))
+			ln->rrm_nr.dirty = true;
+}
+
+/*
+ * Build the neighbor list of a node from its RF neighbors, best ranked first.
+ * Once the node has confirmed RF neighbors, it is limited to
+ * rrm_nr_max_entries; until then the ranking is meaningless and all nodes
+ * are listed. Returns false if it did not change since it was last pushed
+ * to hostapd.
+ */
+static bool
 usteer_local_node_prepare_rrm_set(struct usteer_local_node *ln)
 {
 	struct usteer_remote_node *rn;
 	struct usteer_node *node;
+	struct rrm_nr_cand *cand;
+	uint32_t hash;
 	void *c;
+	int n = 0, i;
 
-	c = blobmsg_open_array(&b, "list");
+	if (ln->rrm_nr.valid && !ln->rrm_nr.dirty) {
+		ln->rrm_nr.unchanged++;
+		return false;
+	}
+
+	ln->rrm_nr.dirty = false;
+	avl_for_each_element(&local_nodes, node, avl)
+		usteer_rrm_nr_cand_add(ln, NULL, &n, node);
+	avl_for_each_element(&remote_nodes, rn, avl)
+		usteer_rrm_nr_cand_add(ln, NULL, &n, &rn->node);
+
+	cand = alloca((n + 1) * sizeof(*cand));
+	n = 0;
 	avl_for_each_element(&local_nodes, node, avl)
-		usteer_add_rrm_data(ln, node);
+		usteer_rrm_nr_cand_add(ln, cand, &n, node);
 	avl_for_each_element(&remote_nodes, rn, avl)
-		usteer_add_rrm_data(ln, &rn->node);
+		usteer_rrm_nr_cand_add(ln, cand, &n, &rn->node);
+
+	qsort(cand, n, sizeof(*cand), usteer_rrm_nr_cand_cmp);
+	if (config.rrm_nr_max_entries && n > config.rrm_nr_max_entries &&
+	    usteer_rf_graph_has_neighbors(&ln->node))
+		n = config.rrm_nr_max_entries;
+
+	c = blobmsg_open_array(&b, "list");
+	for (i = 0; i < n; i++)
+		blobmsg_add_field(&b, BLOBMSG_TYPE_ARRAY, "",
+				  blobmsg_data(cand[i].node->rrm_nr),
+				  blobmsg_data_len(cand[i].node->rrm_nr));
 	blobmsg_close_array(&b, c);
+
+	hash = usteer_rrm_nr_hash(blob_data(b.head), blob_len(b.head));
+	if (ln->rrm_nr.valid && hash == ln->rrm_nr.hash) {
+		ln->rrm_nr.unchanged++;
+		return false;
+	}
+
+	MSG(DEBUG, "neighbor list of %s changed, %d entries\n",
+	    usteer_node_name(&ln->node), n);
+	ln->rrm_nr.valid = true;
+	ln->rrm_nr.hash = hash;
+	ln->rrm_nr.entries = n;
+	ln->rrm_nr.pushed++;
+	usteer_metric_inc(&m_rrm_nr_pushed);
+
+	return true;
 }
 
 static void
@@ -385,24 +721,31 @@ usteer_local_node_state_next(struct uloop_timeout *timeout)
 	switch (ln->req_state) {
 	case REQ_CLIENTS:
 		ubus_invoke_async(ubus_ctx, ln->obj_id, "get_clients", b.head, &ln->req);
-		ln->req.data_cb = usteer_local_node_list_cb;
+		ln->req.data_cb = usteer_local_node_list_cb_profiled;
 		break;
 	case REQ_RRM_SET_LIST:
-		usteer_local_node_prepare_rrm_set(ln);
+		if (!usteer_local_node_prepare_rrm_set(ln)) {
+			uloop_timeout_set(&ln->req_timer, 1);
+			return;
+		}
+
 		ubus_invoke_async(ubus_ctx, ln->obj_id, "rrm_nr_set", b.head, &ln->req);
 		ln->req.data_cb = NULL;
 		break;
 	case REQ_RRM_GET_OWN:
 		ubus_invoke_async(ubus_ctx, ln->obj_id, "rrm_nr_get_own", b.head, &ln->req);
-		ln->req.data_cb = usteer_local_node_rrm_nr_cb;
+		ln->req.data_cb = usteer_local_node_rrm_nr_cb_profiled;
 		break;
 	default:
 		break;
 	}
-	ln->req.complete_cb = usteer_local_node_req_cb;
+	usteer_metric_inc_idx(&m_hostapd_requests, ln->req_state - 1);
+	ln->req.complete_cb = usteer_local_node_req_cb_profiled;
 	ubus_complete_request_async(ubus_ctx, &ln->req);
 }
 
+USTEER_PROFILE_TIMEOUT(LOCAL_NODE_STATE, usteer_local_node_state_next)
+
 static void
 usteer_local_node_update(struct uloop_timeout *timeout)
 {
@@ -413,8 +756,7 @@ usteer_local_node_update(struct uloop_timeout *timeout)
 	ln = container_of(timeout, struct usteer_local_node, update);
 	node = &ln->node;
 
-	MSG_T("local_sta_update", "timeout (%u) expired\n",
-		config.local_sta_update);
+	TRACE(LOCAL_STA_UPDATE, config.local_sta_update);
 
 	list_for_each_entry(h, &node_handlers, list) {
 		if (!h->update_node)
@@ -423,12 +765,15 @@ usteer_local_node_update(struct uloop_timeout *timeout)
 		h->update_node(node);
 	}
 
+	usteer_rf_graph_scan(ln);
 	usteer_local_node_state_reset(ln);
 	uloop_timeout_set(&ln->req_timer, 1);
 	usteer_local_node_kick(ln);
 	uloop_timeout_set(timeout, config.local_sta_update);
 }
 
+USTEER_PROFILE_TIMEOUT(LOCAL_NODE_UPDATE, usteer_local_node_update)
+
 static struct usteer_local_node *
 usteer_get_node(struct ubus_context *ctx, const char *name)
 {
@@ -440,14 +785,15 @@ usteer_get_node(struct ubus_context *ctx, const char *name)
 	if (ln)
 		return ln;
 
-	ln = calloc_a(sizeof(*ln), &str, strlen(name) + 1);
+	ln = usteer_calloc_a(MEM_LOCAL_NODE, sizeof(*ln), &str, strlen(name) + 1);
 	node = &ln->node;
 	node->type = NODE_TYPE_LOCAL;
 	node->avl.key = strcpy(str, name);
 	ln->ev.remove_cb = usteer_handle_remove;
-	ln->ev.cb = usteer_handle_event;
-	ln->update.cb = usteer_local_node_update;
-	ln->req_timer.cb = usteer_local_node_state_next;
+	ln->ev.cb = usteer_handle_event_profiled;
+	ln->update.cb = usteer_local_node_update_profiled;
+	ln->req_timer.cb = usteer_local_node_state_next_profiled;
+	ln->rrm_nr.dirty = true;
 	ubus_register_subscriber(ctx, &ln->ev);
 	avl_insert(&local_nodes, &node->avl);
 	uloop_timeout_set(&ln->update, 1);
@@ -531,11 +877,13 @@ usteer_event_handler(struct ubus_context *ctx, struct ubus_event_handler *ev,
 	usteer_register_node(ctx, path, blobmsg_get_u32(tb[0]));
 }
 
+USTEER_PROFILE_UBUS_EVENT(OBJECT_ADD, usteer_event_handler)
+
 static void
 usteer_register_events(struct ubus_context *ctx)
 {
 	static struct ubus_event_handler handler = {
-	    .cb = usteer_event_handler
+	    .cb = usteer_event_handler_profiled
 	};
 
 	ubus_register_event_handler(ctx, &handler, "ubus.object.add");
@@ -29,13 +29,6 @@ uint64_t current_time;
 
 LIST_HEAD(node_handlers);
 
-const char * const event_types[__EVENT_TYPE_MAX] = {
-	[EVENT_TYPE_PROBE] = "probe",
-	[EVENT_TYPE_AUTH] = "auth",
-	[EVENT_TYPE_ASSOC] = "assoc",
-	[EVENT_TYPE_BEACON] = "beacon-report",
-};
-
 void debug_msg(int level, const char *func, int line, const char *format, ...)
 {
 	va_list ap;
@@ -74,6 +67,12 @@ void usteer_init_defaults(void)
 	config.sta_block_timeout = 30 * 1000;
 	config.local_sta_timeout = 120 * 1000;
 	config.local_sta_update = 1 * 1000;
+	config.probe_sta_timeout = 10 * 1000;
+	config.probe_sta_promote_time = 5 * 1000;
+	config.probe_dedup_window = 100;
+	config.event_rate_limit = 2000;
+	config.event_rate_limit_sta = 50;
+	config.max_probe_stations = 1024;
 	config.max_retry_band = 5;
 	config.seen_policy_timeout = 30 * 1000;
 	config.band_steering_threshold = 5;
@@ -87,6 +86,13 @@ void usteer_init_defaults(void)
 	config.roam_scan_tries = 3;
 	config.roam_scan_interval = 10 * 1000;
 	config.roam_trigger_interval = 60 * 1000;
+	config.roam_predict_time = 3 * 1000;
+
+	config.steer_backoff_max = 4;
+	config.steer_revert_timeout = 5 * 60 * 1000;
+
+	config.signal_filter = SIGNAL_FILTER_EWMA;
+	config.signal_filter_alpha = 40;
 
 	config.load_kick_enabled = false;
 	config.load_kick_threshold = 75;
@@ -97,9 +103,22 @@ void usteer_init_defaults(void)
 	config.kick_client_active_sec = 30;
 	config.kick_client_active_bits = 50000;
 
+	config.airtime_kick_threshold = 0;
+	config.airtime_kick_delay = 10 * 1000;
+	config.airtime_kick_throughput = 20000;
+
 	config.beacon_report_invalide_timeout = 200;
 	config.beacon_request_frequency = 30 * 1000;
 	config.beacon_request_signal_modifier = 20 * 1000;
+	config.beacon_request_rate = 2;
+	config.beacon_request_burst = 5;
+	config.hearing_map_share_interval = 10 * 1000;
+
+	config.rf_scan_interval = 0;
+	config.rf_neighbor_min_count = 3;
+	config.rrm_nr_max_entries = 6;
+
+	config.profile_stall_threshold = 0;
 
 	config.debug_level = MSG_FATAL;
 
@@ -114,6 +133,22 @@ void usteer_update_time(void)
 	current_time = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+/*
+ * Tick resolution time for the event path, served from the vDSO without
+ * reading the clock source. It lags CLOCK_MONOTONIC by up to a tick, so
+ * never let it move current_time backwards.
+ */
+void usteer_update_time_coarse(void)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	now = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	if (now > current_time)
+		current_time = now;
+}
+
 static int usage(const char *prog)
 {
 	fprintf(stderr, "Usage: %s [options]\n"
@@ -0,0 +1,115 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <malloc.h>
+
+#include "usteer.h"
+#include "mem.h"
+#include "metrics.h"
+
+struct usteer_mem_stats {
+	size_t bytes;
+	size_t bytes_max;
+	unsigned int count;
+	unsigned int count_max;
+};
+
+static const char * const mem_types[__MEM_MAX] = {
+#define _M(_id, _name) [MEM_##_id] = _name,
+	__mem_types
+#undef _M
+};
+
+static struct usteer_mem_stats mem_stats[__MEM_MAX];
+
+LIST_HEAD(usteer_mem_blob_bufs);
+
+static int64_t usteer_mem_bytes(unsigned int idx)
+{
+	return mem_stats[idx].bytes;
+}
+
+USTEER_GAUGE_VEC_FN(m_bytes, "memory_bytes", "Heap memory in use",
+		    "type", mem_types, __MEM_MAX, usteer_mem_bytes);
+
+/*
+ * The usable size includes the allocator's rounding, so this is what the
+ * objects really take from the heap (minus the allocator's own headers).
+ */
+void usteer_mem_alloc(enum usteer_mem_type type, void *ptr)
+{
+	struct usteer_mem_stats *s = &mem_stats[type];
+
+	if (!ptr)
+		return;
+
+	s->bytes += malloc_usable_size(ptr);
+	s->count++;
+	if (s->bytes > s->bytes_max)
+		s->bytes_max = s->bytes;
+	if (s->count > s->count_max)
+		s->count_max = s->count;
+}
+
+void usteer_mem_free(enum usteer_mem_type type, void *ptr)
+{
+	struct usteer_mem_stats *s = &mem_stats[type];
+
+	if (!ptr)
+		return;
+
+	s->bytes -= malloc_usable_size(ptr);
+	s->count--;
+}
+
+void usteer_mem_dump(struct blob_buf *buf)
+{
+	static size_t blob_bufs_max;
+	struct usteer_mem_blob_buf *bb;
+	struct usteer_mem_stats *s;
+	size_t blob_bufs = 0, total = 0;
+	void *c, *t;
+	int i;
+
+	for (i = 0; i < __MEM_MAX; i++) {
+		s = &mem_stats[i];
+		t = blobmsg_open_table(buf, mem_types[i]);
+		blobmsg_add_u64(buf, "bytes", s->bytes);
+		blobmsg_add_u64(buf, "bytes_max", s->bytes_max);
+		blobmsg_add_u32(buf, "count", s->count);
+		blobmsg_add_u32(buf, "count_max", s->count_max);
+		blobmsg_close_table(buf, t);
+		total += s->bytes;
+	}
+
+	/*
+	 * The static buffers are reused and never shrink, their maximum is
+	 * only sampled here.
+	 */
+	t = blobmsg_open_table(buf, "blob_buf");
+	c = blobmsg_open_table(buf, "buffers");
+	list_for_each_entry(bb, &usteer_mem_blob_bufs, list) {
+		blobmsg_add_u32(buf, bb->name, bb->buf->buflen);
+		blob_bufs += bb->buf->buflen;
+	}
+	blobmsg_close_table(buf, c);
+	if (blob_bufs > blob_bufs_max)
+		blob_bufs_max = blob_bufs;
+	blobmsg_add_u64(buf, "bytes", blob_bufs);
+	blobmsg_add_u64(buf, "bytes_max", blob_bufs_max);
+	blobmsg_close_table(buf, t);
+
+	blobmsg_add_u64(buf, "total", total + blob_bufs);
+}
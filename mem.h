@@ -0,0 +1,94 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __APMGR_MEM_H
+#define __APMGR_MEM_H
+
+#include <stdlib.h>
+#include <libubox/list.h>
+#include <libubox/blobmsg.h>
+#include <libubox/utils.h>
+
+#include "utils.h"
+
+#define __mem_types \
+	_M(STA, "sta") \
+	_M(STA_INFO, "sta_info") \
+	_M(STA_INFO_EXT, "sta_info_ext") /* beacon reports, signal history, ... */ \
+	_M(PROBE_STA, "probe_sta") \
+	_M(LOCAL_NODE, "local_node") \
+	_M(REMOTE_NODE, "remote_node") \
+	_M(NODE_BLOB, "node_blob") /* rrm_nr and script_data copies */ \
+	_M(INTERFACE, "interface") \
+	_M(RF_EDGE, "rf_edge") \
+	_M(PROMETHEUS, "prometheus")
+
+enum usteer_mem_type {
+#define _M(_id, _name) MEM_##_id,
+	__mem_types
+#undef _M
+	__MEM_MAX
+};
+
+/*
+ * Account the heap block at ptr (may be NULL) to a category, by its usable
+ * size. Blocks must be released to the category they were accounted to.
+ */
+void usteer_mem_alloc(enum usteer_mem_type type, void *ptr);
+void usteer_mem_free(enum usteer_mem_type type, void *ptr);
+void usteer_mem_dump(struct blob_buf *buf);
+
+static inline void *usteer_calloc(enum usteer_mem_type type, size_t size)
+{
+	void *ptr = calloc(1, size);
+
+	usteer_mem_alloc(type, ptr);
+	return ptr;
+}
+
+#define usteer_calloc_a(_type, _len, ...)					\
+	({									\
+		void *__ptr = calloc_a(_len, ##__VA_ARGS__);			\
+		usteer_mem_alloc(_type, __ptr);					\
+		__ptr;								\
+	})
+
+static inline void usteer_free(enum usteer_mem_type type, void *ptr)
+{
+	usteer_mem_free(type, ptr);
+	free(ptr);
+}
+
+struct usteer_mem_blob_buf {
+	struct list_head list;
+	struct blob_buf *buf;
+	const char *name;
+};
+
+extern struct list_head usteer_mem_blob_bufs;
+
+/* static blob_buf whose buffer size is reported under the given name */
+#define USTEER_BLOB_BUF(_var, _name)						\
+	static struct blob_buf _var;						\
+	static struct usteer_mem_blob_buf _var##_mem = {			\
+		.buf = &_var,							\
+		.name = _name,							\
+	};									\
+	static void __usteer_init _var##_mem_register(void)			\
+	{									\
+		list_add_tail(&_var##_mem.list, &usteer_mem_blob_bufs);	\
+	}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "usteer.h"
+#include "metrics.h"
+
+LIST_HEAD(usteer_metrics);
+
+/* keep the list sorted by name, constructors run in link order */
+void usteer_metric_register(struct usteer_metric *m)
+{
+	struct usteer_metric *cur;
+
+	list_for_each_entry(cur, &usteer_metrics, list) {
+		if (strcmp(cur->name, m->name) > 0)
+			break;
+	}
+
+	list_add_tail(&m->list, &cur->list);
+}
+
+void usteer_metric_observe(struct usteer_metric *m, int32_t val)
+{
+	unsigned int i;
+
+	for (i = 0; i < m->n_bounds; i++)
+		if (val <= m->bounds[i])
+			break;
+
+	m->values[i]++;
+	m->sum += val;
+}
+
+static void
+usteer_metric_dump_histogram(struct blob_buf *buf, struct usteer_metric *m)
+{
+	int64_t count = 0;
+	unsigned int i;
+	char name[16];
+	void *c, *b;
+
+	c = blobmsg_open_table(buf, m->name);
+	b = blobmsg_open_table(buf, "buckets");
+	for (i = 0; i <= m->n_bounds; i++) {
+		count += m->values[i];
+		if (i == m->n_bounds)
+			strcpy(name, "+Inf");
+		else
+			snprintf(name, sizeof(name), "%d", m->bounds[i]);
+		blobmsg_add_u64(buf, name, count);
+	}
+	blobmsg_close_table(buf, b);
+	blobmsg_add_u64(buf, "count", count);
+	blobmsg_add_u64(buf, "sum", m->sum);
+	blobmsg_close_table(buf, c);
+}
+
+void usteer_metrics_dump(struct blob_buf *buf)
+{
+	struct usteer_metric *m;
+	unsigned int i;
+	void *c;
+
+	list_for_each_entry(m, &usteer_metrics, list) {
+		if (m->type == METRIC_HISTOGRAM) {
+			usteer_metric_dump_histogram(buf, m);
+			continue;
+		}
+
+		if (!m->label) {
+			blobmsg_add_u64(buf, m->name, usteer_metric_value(m, 0));
+			continue;
+		}
+
+		c = blobmsg_open_table(buf, m->name);
+		for (i = 0; i < m->n; i++)
+			blobmsg_add_u64(buf, m->label_values[i], usteer_metric_value(m, i));
+		blobmsg_close_table(buf, c);
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __APMGR_METRICS_H
+#define __APMGR_METRICS_H
+
+#include <libubox/list.h>
+#include <libubox/blobmsg.h>
+#include <libubox/utils.h>
+
+#include "utils.h"
+
+enum usteer_metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+/*
+ * Counters and gauges hold one value, or one per label value (vectors).
+ * Gauges with a get callback are computed when read. Histograms count
+ * observations <= bounds[i] in values[i], the rest in values[n_bounds].
+ */
+struct usteer_metric {
+	struct list_head list;
+	const char *name;
+	const char *help;
+	enum usteer_metric_type type;
+
+	const char *label;
+	const char * const *label_values;
+	unsigned int n;
+
+	int64_t *values;
+	int64_t (*get)(unsigned int idx);
+
+	const int32_t *bounds;
+	unsigned int n_bounds;
+	int64_t sum;
+};
+
+void usteer_metric_register(struct usteer_metric *m);
+void usteer_metric_observe(struct usteer_metric *m, int32_t val);
+void usteer_metrics_dump(struct blob_buf *buf);
+
+extern struct list_head usteer_metrics;
+
+#define __USTEER_METRIC(_var, _n, ...)						\
+	static int64_t _var##_values[_n];					\
+	static struct usteer_metric _var = {					\
+		.n = _n,							\
+		.values = _var##_values,					\
+		__VA_ARGS__							\
+	};									\
+	static void __usteer_init _var##_register(void)				\
+	{									\
+		usteer_metric_register(&_var);					\
+	}
+
+#define USTEER_COUNTER(_var, _name, _help)					\
+	__USTEER_METRIC(_var, 1, .name = _name, .help = _help,			\
+			.type = METRIC_COUNTER)
+
+#define USTEER_COUNTER_VEC(_var, _name, _help, _label, _values, _n)		\
+	__USTEER_METRIC(_var, _n, .name = _name, .help = _help,		\
+			.type = METRIC_COUNTER, .label = _label,		\
+			.label_values = _values)
+
+#define USTEER_GAUGE(_var, _name, _help)					\
+	__USTEER_METRIC(_var, 1, .name = _name, .help = _help,			\
+			.type = METRIC_GAUGE)
+
+#define USTEER_GAUGE_FN(_var, _name, _help, _get)				\
+	__USTEER_METRIC(_var, 1, .name = _name, .help = _help,			\
+			.type = METRIC_GAUGE, .get = _get)
+
+#define USTEER_GAUGE_VEC_FN(_var, _name, _help, _label, _values, _n, _get)	\
+	__USTEER_METRIC(_var, _n, .name = _name, .help = _help,		\
+			.type = METRIC_GAUGE, .label = _label,			\
+			.label_values = _values, .get = _get)
+
+#define USTEER_HISTOGRAM(_var, _name, _help, ...)				\
+	static const int32_t _var##_bounds[] = { __VA_ARGS__ };		\
+	__USTEER_METRIC(_var, ARRAY_SIZE(_var##_bounds) + 1,			\
+			.name = _name, .help = _help,				\
+			.type = METRIC_HISTOGRAM, .bounds = _var##_bounds,	\
+			.n_bounds = ARRAY_SIZE(_var##_bounds))
+
+static inline void usteer_metric_inc(struct usteer_metric *m)
+{
+	m->values[0]++;
+}
+
+static inline void usteer_metric_inc_idx(struct usteer_metric *m, unsigned int idx)
+{
+	if (idx < m->n)
+		m->values[idx]++;
+}
+
+static inline void usteer_metric_add(struct usteer_metric *m, int64_t val)
+{
+	m->values[0] += val;
+}
+
+static inline void usteer_metric_set(struct usteer_metric *m, int64_t val)
+{
+	m->values[0] = val;
+}
+
+static inline int64_t usteer_metric_value(struct usteer_metric *m, unsigned int idx)
+{
+	return m->get ? m->get(idx) : m->values[idx];
+}
+
+#endif
@@ -19,8 +19,10 @@
 
 #include "usteer.h"
 #include "node.h"
+#include "profile.h"
+#include "mem.h"
 
-static struct blob_buf b;
+USTEER_BLOB_BUF(b, "netifd")
 
 static void
 netifd_parse_interface_config(struct usteer_local_node *ln, struct blob_attr *msg)
@@ -102,6 +104,8 @@ netifd_status_cb(struct ubus_request *req, int type, struct blob_attr *msg)
 		netifd_parse_radio(ln, cur);
 }
 
+USTEER_PROFILE_UBUS_DATA(NETIFD_STATUS, netifd_status_cb)
+
 static void netifd_update_node(struct usteer_node *node)
 {
 	struct usteer_local_node *ln;
@@ -119,7 +123,7 @@ static void netifd_update_node(struct usteer_node *node)
 
 	blob_buf_init(&b, 0);
 	ubus_invoke_async(ubus_ctx, id, "status", b.head, &ln->netifd.req);
-	ln->netifd.req.data_cb = netifd_status_cb;
+	ln->netifd.req.data_cb = netifd_status_cb_profiled;
 	ubus_complete_request_async(ubus_ctx, &ln->netifd.req);
 	ln->netifd.req_pending = true;
 }
@@ -35,10 +35,61 @@
 
 #include "usteer.h"
 #include "node.h"
+#include "metrics.h"
+#include "probe.h"
+#include "profile.h"
 
 static struct unl unl;
 static struct nlattr *tb[NL80211_ATTR_MAX + 1];
 
+/* subscribed to scan events, kept apart from the requests on unl */
+static struct unl unl_scan;
+static struct uloop_fd unl_scan_fd;
+static struct nl_cb *unl_scan_cb;
+
+enum {
+	NL80211_REQ_INTERFACE,
+	NL80211_REQ_SURVEY,
+	NL80211_REQ_STATION,
+	NL80211_REQ_SCAN,
+	NL80211_REQ_SCAN_RESULTS,
+	NL80211_REQ_FREQLIST,
+	__NL80211_REQ_MAX
+};
+
+static const char * const nl80211_req_names[__NL80211_REQ_MAX] = {
+	[NL80211_REQ_INTERFACE] = "interface",
+	[NL80211_REQ_SURVEY] = "survey",
+	[NL80211_REQ_STATION] = "station",
+	[NL80211_REQ_SCAN] = "scan",
+	[NL80211_REQ_SCAN_RESULTS] = "scan_results",
+	[NL80211_REQ_FREQLIST] = "freqlist",
+};
+
+USTEER_COUNTER_VEC(m_requests, "nl80211_requests_total", "nl80211 requests",
+		   "command", nl80211_req_names, __NL80211_REQ_MAX);
+USTEER_COUNTER_VEC(m_errors, "nl80211_errors_total", "Failed nl80211 requests",
+		   "command", nl80211_req_names, __NL80211_REQ_MAX);
+
+static uint64_t nl80211_req_start;
+
+static void nl80211_request_start(int type, struct usteer_local_node *ln)
+{
+	USTEER_PROBE(nl80211_start, nl80211_req_names[type], ln->ifindex);
+	nl80211_req_start = usteer_probe_time();
+}
+
+static int nl80211_request_done(int type, int ret)
+{
+	USTEER_PROBE(nl80211_done, nl80211_req_names[type], ret,
+		     usteer_probe_time() - nl80211_req_start);
+	usteer_metric_inc_idx(&m_requests, type);
+	if (ret < 0)
+		usteer_metric_inc_idx(&m_errors, type);
+
+	return ret;
+}
+
 struct nl80211_survey_req {
 	void (*cb)(void *priv, struct usteer_survey_data *d);
 	void *priv;
@@ -113,7 +164,9 @@ static void nl80211_get_survey(struct usteer_node *node, void *priv,
 
 	msg = unl_genl_msg(&unl, NL80211_CMD_GET_SURVEY, true);
 	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
-	unl_genl_request(&unl, msg, nl80211_survey_result, &req);
+	nl80211_request_start(NL80211_REQ_SURVEY, ln);
+	nl80211_request_done(NL80211_REQ_SURVEY,
+			     unl_genl_request(&unl, msg, nl80211_survey_result, &req));
 
 nla_put_failure:
 	return;
@@ -159,6 +212,8 @@ static void nl80211_update_node(struct uloop_timeout *t)
 	nl80211_get_survey(&ln->node, ln, nl80211_update_node_result);
 }
 
+USTEER_PROFILE_TIMEOUT(NL80211_UPDATE, nl80211_update_node)
+
 static void nl80211_init_node(struct usteer_node *node)
 {
 	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
@@ -189,8 +244,9 @@ static void nl80211_init_node(struct usteer_node *node)
 
 	msg = unl_genl_msg(&unl, NL80211_CMD_GET_INTERFACE, false);
 	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
+	nl80211_request_start(NL80211_REQ_INTERFACE, ln);
 	unl_genl_request_single(&unl, msg, &msg);
-	if (!msg)
+	if (nl80211_request_done(NL80211_REQ_INTERFACE, msg ? 0 : -1) < 0)
 		return;
 
 	gnlh = nlmsg_data(nlmsg_hdr(msg));
@@ -210,12 +266,13 @@ static void nl80211_init_node(struct usteer_node *node)
 
 		memcpy(node->ssid, nla_data(tb[NL80211_ATTR_SSID]), len);
 		node->ssid[len] = 0;
+		ln->rrm_nr.dirty = true;
 	}
 
 	MSG(INFO, "Found nl80211 phy on wdev %s, ssid=%s\n", usteer_node_name(node), node->ssid);
 	ln->load_ewma = -1;
 	ln->nl80211.present = true;
-	ln->nl80211.update.cb = nl80211_update_node;
+	ln->nl80211.update.cb = nl80211_update_node_profiled;
 	nl80211_update_node(&ln->nl80211.update);
 
 nla_put_failure:
@@ -233,6 +290,56 @@ static void nl80211_free_node(struct usteer_node *node)
 	uloop_timeout_cancel(&ln->nl80211.update);
 }
 
+static uint32_t nl80211_parse_rate(struct nlattr *attr)
+{
+	struct nlattr *tb_rate[NL80211_RATE_INFO_MAX + 1];
+
+	if (!attr || nla_parse_nested(tb_rate, NL80211_RATE_INFO_MAX, attr, NULL))
+		return 0;
+
+	/* both in units of 100 kbit/s */
+	if (tb_rate[NL80211_RATE_INFO_BITRATE32])
+		return nla_get_u32(tb_rate[NL80211_RATE_INFO_BITRATE32]) * 100;
+
+	if (tb_rate[NL80211_RATE_INFO_BITRATE])
+		return nla_get_u16(tb_rate[NL80211_RATE_INFO_BITRATE]) * 100;
+
+	return 0;
+}
+
+static void nl80211_update_sta_airtime(struct sta_info *si, struct nlattr **tb_sta)
+{
+	struct sta_airtime *at = &si->ext->airtime;
+	uint64_t duration = 0;
+
+	at->tx_bitrate = nl80211_parse_rate(tb_sta[NL80211_STA_INFO_TX_BITRATE]);
+	at->rx_bitrate = nl80211_parse_rate(tb_sta[NL80211_STA_INFO_RX_BITRATE]);
+
+	if (tb_sta[NL80211_STA_INFO_EXPECTED_THROUGHPUT])
+		at->expected_throughput = nla_get_u32(tb_sta[NL80211_STA_INFO_EXPECTED_THROUGHPUT]);
+
+	if (!tb_sta[NL80211_STA_INFO_TX_DURATION] &&
+	    !tb_sta[NL80211_STA_INFO_RX_DURATION])
+		return;
+
+	if (tb_sta[NL80211_STA_INFO_TX_DURATION])
+		duration += nla_get_u64(tb_sta[NL80211_STA_INFO_TX_DURATION]);
+	if (tb_sta[NL80211_STA_INFO_RX_DURATION])
+		duration += nla_get_u64(tb_sta[NL80211_STA_INFO_RX_DURATION]);
+
+	/* usec of airtime per msec of wall time is permille */
+	if (at->last_time && current_time > at->last_time &&
+	    duration >= at->duration) {
+		uint64_t share = (duration - at->duration) /
+				 (current_time - at->last_time);
+
+		at->share = share > 1000 ? 1000 : share;
+	}
+
+	at->duration = duration;
+	at->last_time = current_time;
+}
+
 static void nl80211_update_sta(struct usteer_node *node, struct sta_info *si)
 {
 	struct nlattr *tb_sta[NL80211_STA_INFO_MAX + 1];
@@ -247,8 +354,9 @@ static void nl80211_update_sta(struct usteer_node *node, struct sta_info *si)
 	msg = unl_genl_msg(&unl, NL80211_CMD_GET_STATION, false);
 	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
 	NLA_PUT(msg, NL80211_ATTR_MAC, ETH_ALEN, si->sta->addr);
+	nl80211_request_start(NL80211_REQ_STATION, ln);
 	unl_genl_request_single(&unl, msg, &msg);
-	if (!msg)
+	if (nl80211_request_done(NL80211_REQ_STATION, msg ? 0 : -1) < 0)
 		return;
 
 	gnlh = nlmsg_data(nlmsg_hdr(msg));
@@ -266,6 +374,7 @@ static void nl80211_update_sta(struct usteer_node *node, struct sta_info *si)
 		signal = (int8_t) nla_get_u8(tb_sta[NL80211_STA_INFO_SIGNAL_AVG]);
 
 	usteer_sta_info_update(si, signal, true);
+	nl80211_update_sta_airtime(si, tb_sta);
 
 nla_put_failure:
 	nlmsg_free(msg);
@@ -338,28 +447,116 @@ skip_ie:
 	return NL_SKIP;
 }
 
+static void nl80211_scan_results(struct usteer_local_node *ln)
+{
+	struct nl80211_scan_req reqdata = {
+		.priv = ln->nl80211.scan_priv,
+		.cb = ln->nl80211.scan_cb,
+	};
+	struct nl_msg *msg;
+
+	ln->nl80211.scan_cb = NULL;
+	ln->nl80211.scan_priv = NULL;
+
+	msg = unl_genl_msg(&unl, NL80211_CMD_GET_SCAN, true);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
+	nl80211_request_start(NL80211_REQ_SCAN_RESULTS, ln);
+	nl80211_request_done(NL80211_REQ_SCAN_RESULTS,
+			     unl_genl_request(&unl, msg, nl80211_scan_result, &reqdata));
+	return;
+
+nla_put_failure:
+	nlmsg_free(msg);
+}
+
 static int nl80211_scan_event_cb(struct nl_msg *msg, void *data)
 {
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct usteer_local_node *ln;
+	int ifindex;
+
+	if (gnlh->cmd != NL80211_CMD_NEW_SCAN_RESULTS &&
+	    gnlh->cmd != NL80211_CMD_SCAN_ABORTED)
+		return NL_SKIP;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_IFINDEX])
+		return NL_SKIP;
+
+	ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	avl_for_each_element(&local_nodes, ln, node.avl) {
+		if (ln->ifindex != ifindex || !ln->nl80211.scan_cb)
+			continue;
 
-	switch (gnlh->cmd) {
-	case NL80211_CMD_NEW_SCAN_RESULTS:
-	case NL80211_CMD_SCAN_ABORTED:
-		unl_loop_done(&unl);
+		if (gnlh->cmd == NL80211_CMD_SCAN_ABORTED) {
+			MSG(DEBUG, "scan on node %s aborted\n", usteer_node_name(&ln->node));
+			ln->nl80211.scan_cb = NULL;
+			ln->nl80211.scan_priv = NULL;
+			break;
+		}
+
+		nl80211_scan_results(ln);
 		break;
 	}
 
 	return NL_SKIP;
 }
 
+static int nl80211_scan_no_seq_check(struct nl_msg *msg, void *arg)
+{
+	return NL_OK;
+}
+
+static void nl80211_scan_fd_cb(struct uloop_fd *u, unsigned int events)
+{
+	usteer_update_time();
+	nl_recvmsgs(unl_scan.sock, unl_scan_cb);
+}
+
+USTEER_PROFILE_FD(NL80211_SCAN, nl80211_scan_fd_cb)
+
+static int nl80211_scan_init(void)
+{
+	if (unl_scan_cb)
+		return 0;
+
+	if (unl_genl_init(&unl_scan, "nl80211") < 0)
+		goto error;
+
+	if (unl_genl_subscribe(&unl_scan, "scan") < 0)
+		goto error;
+
+	unl_scan_cb = nl_cb_alloc(NL_CB_CUSTOM);
+	if (!unl_scan_cb)
+		goto error;
+
+	nl_cb_set(unl_scan_cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_scan_event_cb, NULL);
+	nl_cb_set(unl_scan_cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, nl80211_scan_no_seq_check, NULL);
+	nl_socket_set_nonblocking(unl_scan.sock);
+
+	unl_scan_fd.fd = nl_socket_get_fd(unl_scan.sock);
+	unl_scan_fd.cb = nl80211_scan_fd_cb_profiled;
+	uloop_fd_add(&unl_scan_fd, ULOOP_READ);
+
+	return 0;
+
+error:
+	MSG(INFO, "nl80211 scan event init failed\n");
+	unl_free(&unl_scan);
+	return -1;
+}
+
+/*
+ * Starts the scan and returns, the results are fetched once the scan event
+ * arrives on unl_scan. A scan takes seconds, the event loop must not wait
+ * for it.
+ */
 static int nl80211_scan(struct usteer_node *node, struct usteer_scan_request *req,
 			void *priv, void (*cb)(void *priv, struct usteer_scan_result *r))
 {
 	struct usteer_local_node *ln = container_of(node, struct usteer_local_node, node);
-	struct nl80211_scan_req reqdata = {
-		.priv = priv,
-		.cb = cb,
-	};
 	struct nl_msg *msg;
 	struct nlattr *cur;
 	int i, ret;
@@ -367,6 +564,9 @@ static int nl80211_scan(struct usteer_node *node, struct usteer_scan_request *re
 	if (!ln->nl80211.present)
 		return -ENODEV;
 
+	if (cb && nl80211_scan_init() < 0)
+		return -ENOTSUP;
+
 	msg = unl_genl_msg(&unl, NL80211_CMD_TRIGGER_SCAN, false);
 	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
 
@@ -385,24 +585,13 @@ static int nl80211_scan(struct usteer_node *node, struct usteer_scan_request *re
 		nla_nest_end(msg, cur);
 	}
 
-	unl_genl_subscribe(&unl, "scan");
-	ret = unl_genl_request(&unl, msg, NULL, NULL);
-	if (ret < 0)
-		goto done;
-
-	unl_genl_loop(&unl, nl80211_scan_event_cb, NULL);
-
-done:
-	unl_genl_unsubscribe(&unl, "scan");
+	nl80211_request_start(NL80211_REQ_SCAN, ln);
+	ret = nl80211_request_done(NL80211_REQ_SCAN, unl_genl_request(&unl, msg, NULL, NULL));
 	if (ret < 0)
 		return ret;
 
-	if (!cb)
-		return 0;
-
-	msg = unl_genl_msg(&unl, NL80211_CMD_GET_SCAN, true);
-	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ln->ifindex);
-	unl_genl_request(&unl, msg, nl80211_scan_result, &reqdata);
+	ln->nl80211.scan_cb = cb;
+	ln->nl80211.scan_priv = priv;
 
 	return 0;
 
@@ -487,7 +676,9 @@ static void nl80211_get_freqlist(struct usteer_node *node, void *priv,
 	NLA_PUT_U32(msg, NL80211_ATTR_WIPHY, ln->wiphy);
 	NLA_PUT_FLAG(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP);
 
-	unl_genl_request(&unl, msg, nl80211_wiphy_result, &req);
+	nl80211_request_start(NL80211_REQ_FREQLIST, ln);
+	nl80211_request_done(NL80211_REQ_FREQLIST,
+			     unl_genl_request(&unl, msg, nl80211_wiphy_result, &req));
 
 	return;
 
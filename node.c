@@ -18,21 +18,34 @@
  */
 
 #include "usteer.h"
+#include "mem.h"
 
-void usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val)
+/* returns true if the contents changed */
+bool usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val)
 {
 	int new_len;
 	int len;
 
 	if (!val) {
-		free(*dest);
+		if (!*dest)
+			return false;
+
+		usteer_free(MEM_NODE_BLOB, *dest);
 		*dest = NULL;
-		return;
+		return true;
 	}
 
 	len = *dest ? blob_pad_len(*dest) : 0;
 	new_len = blob_pad_len(val);
-	if (new_len != len)
+	if (new_len == len && !memcmp(*dest, val, len))
+		return false;
+
+	if (new_len != len) {
+		usteer_mem_free(MEM_NODE_BLOB, *dest);
 		*dest = realloc(*dest, new_len);
+		usteer_mem_alloc(MEM_NODE_BLOB, *dest);
+	}
 	memcpy(*dest, val, new_len);
+
+	return true;
 }
@@ -48,12 +48,44 @@ struct usteer_local_node {
 
 	float load_ewma;
 	int load_thr_count;
+	int airtime_thr_count;
+
+	struct usteer_steer_stats steer_stats[__STEER_REASON_MAX];
+
+	struct {
+		struct usteer_token_bucket tb;
+		uint32_t queued;
+		uint32_t sent;
+		uint32_t deferred;
+		uint32_t downgraded;
+	} beacon_req;
 
 	uint64_t time, time_busy;
+	uint64_t rf_scan_time;
+
+	struct {
+		uint32_t sent;
+		uint32_t accepted;
+		uint32_t rejected;
+		uint32_t timeout;
+	} btm;
+
+	struct {
+		bool valid;
+		bool dirty; /* inputs changed since the list was last built */
+		uint32_t hash; /* of the last list pushed to hostapd */
+		uint32_t entries;
+		uint32_t pushed;
+		uint32_t unchanged;
+	} rrm_nr;
 
 	struct {
 		bool present;
 		struct uloop_timeout update;
+
+		/* running scan, results are passed to scan_cb once it finished */
+		void (*scan_cb)(void *priv, struct usteer_scan_result *r);
+		void *scan_priv;
 	} nl80211;
 	struct {
 		struct ubus_request req;
@@ -71,6 +103,7 @@ struct usteer_remote_node {
 	struct interface *iface;
 
 	int check;
+	uint32_t updates;
 };
 
 extern struct avl_tree local_nodes;
@@ -61,6 +61,7 @@ bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data)
 		[APMSG_NODE_LOAD] = { .type = BLOB_ATTR_INT32 },
 		[APMSG_NODE_RRM_NR] = { .type = BLOB_ATTR_NESTED },
 		[APMSG_NODE_SCRIPT_DATA] = { .type = BLOB_ATTR_NESTED },
+		[APMSG_NODE_AIRTIME] = { .type = BLOB_ATTR_INT32 },
 	};
 	struct blob_attr *tb[__APMSG_NODE_MAX];
 	struct blob_attr *cur;
@@ -82,6 +83,7 @@ bool parse_apmsg_node(struct apmsg_node *msg, struct blob_attr *data)
 
 	msg->noise = get_int32(tb[APMSG_NODE_NOISE]);
 	msg->load = get_int32(tb[APMSG_NODE_LOAD]);
+	msg->airtime = get_int32(tb[APMSG_NODE_AIRTIME]);
 	msg->max_assoc = get_int32(tb[APMSG_NODE_MAX_ASSOC]);
 	msg->rrm_nr = NULL;
 
@@ -119,6 +121,8 @@ bool parse_apmsg_sta(struct apmsg_sta *msg, struct blob_attr *data)
 		[APMSG_STA_SEEN] = { .type = BLOB_ATTR_INT32 },
 		[APMSG_STA_TIMEOUT] = { .type = BLOB_ATTR_INT32 },
 		[APMSG_STA_CONNECTED] = { .type = BLOB_ATTR_INT8 },
+		[APMSG_STA_ROAM_HISTORY] = { .type = BLOB_ATTR_BINARY },
+		[APMSG_STA_HEARING_MAP] = { .type = BLOB_ATTR_BINARY },
 	};
 	struct blob_attr *tb[__APMSG_STA_MAX];
 
@@ -139,5 +143,23 @@ bool parse_apmsg_sta(struct apmsg_sta *msg, struct blob_attr *data)
 	msg->timeout = blob_get_int32(tb[APMSG_STA_TIMEOUT]);
 	msg->connected = blob_get_int8(tb[APMSG_STA_CONNECTED]);
 
+	msg->roam_history = NULL;
+	msg->n_roam_history = 0;
+	if (tb[APMSG_STA_ROAM_HISTORY] &&
+	    !(blob_len(tb[APMSG_STA_ROAM_HISTORY]) % sizeof(*msg->roam_history))) {
+		msg->roam_history = blob_data(tb[APMSG_STA_ROAM_HISTORY]);
+		msg->n_roam_history = blob_len(tb[APMSG_STA_ROAM_HISTORY]) /
+				      sizeof(*msg->roam_history);
+	}
+
+	msg->hearing_map = NULL;
+	msg->n_hearing_map = 0;
+	if (tb[APMSG_STA_HEARING_MAP] &&
+	    !(blob_len(tb[APMSG_STA_HEARING_MAP]) % sizeof(*msg->hearing_map))) {
+		msg->hearing_map = blob_data(tb[APMSG_STA_HEARING_MAP]);
+		msg->n_hearing_map = blob_len(tb[APMSG_STA_HEARING_MAP]) /
+				     sizeof(*msg->hearing_map);
+	}
+
 	return true;
 }
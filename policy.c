@@ -20,6 +20,37 @@
 #include "usteer.h"
 #include "node.h"
 #include "hearing_map.h"
+#include "rf_graph.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probe.h"
+
+enum {
+	BTM_RESULT_ACCEPTED,
+	BTM_RESULT_REJECTED,
+	BTM_RESULT_TIMEOUT,
+	__BTM_RESULT_MAX
+};
+
+static const char * const btm_results[__BTM_RESULT_MAX] = {
+	[BTM_RESULT_ACCEPTED] = "accepted",
+	[BTM_RESULT_REJECTED] = "rejected",
+	[BTM_RESULT_TIMEOUT] = "timeout",
+};
+
+static const char * const roam_trigger_states[] = {
+#define _S(n) [ROAM_TRIGGER_##n] = #n,
+	__roam_trigger_states
+#undef _S
+};
+
+USTEER_COUNTER_VEC(m_roam_transitions, "roam_transitions_total",
+		   "Roam trigger state machine transitions by new state", "state",
+		   roam_trigger_states, ARRAY_SIZE(roam_trigger_states));
+USTEER_COUNTER(m_roam_scans, "roam_scans_total", "Scans requested from roaming clients");
+USTEER_COUNTER_VEC(m_btm_results, "btm_results_total",
+		   "Outcome of BSS transition requests", "result",
+		   btm_results, __BTM_RESULT_MAX);
 
 static bool
 below_assoc_threshold(struct usteer_node *node_cur, struct usteer_node *node_new, struct sta_info *si)
@@ -37,10 +68,9 @@ below_assoc_threshold(struct usteer_node *node_cur, struct usteer_node *node_new
 	n_assoc_new += config.load_balancing_threshold;
 
 	if (n_assoc_new > n_assoc_cur) {
-		MSG_T_STA("band_steering_threshold,load_balancing_threshold",
-			si->sta->addr, "exeeded (bs=%u, lb=%u)\n",
-			config.band_steering_threshold,
-			config.load_balancing_threshold);
+		TRACE_ADDR(ASSOC_THRESHOLD, si->sta->addr,
+			   config.band_steering_threshold,
+			   config.load_balancing_threshold);
 	}
 	return n_assoc_new <= n_assoc_cur;
 }
@@ -55,16 +85,16 @@ better_signal_strength(struct sta_info *si_cur, struct sta_info *si_new)
 		return false;
 
 	if (is_better) {
-		MSG_T_STA("signal_diff_threshold", si_cur->sta->addr,
-			"exceeded (config=%i) (real=%i)\n",
-			config.signal_diff_threshold,
-			si_new->signal - si_cur->signal);
+		TRACE_ADDR(SIGNAL_DIFF, si_cur->sta->addr,
+			   config.signal_diff_threshold,
+			   si_new->signal - si_cur->signal);
 	}
 	return is_better;
 }
 
 static bool
-better_signal_strength_hearing_map(struct beacon_report *br_cur, struct beacon_report *br_new)
+better_signal_strength_hearing_map(struct sta_info *si, struct beacon_report *br_cur,
+				   struct beacon_report *br_new)
 {
 	uint16_t rcpi_threshold = (config.signal_diff_threshold / 100) * 255;
 	const bool is_better = br_new->rcpi - br_cur->rcpi
@@ -74,10 +104,8 @@ better_signal_strength_hearing_map(struct beacon_report *br_cur, struct beacon_r
 		return false;
 
 	if (is_better) {
-		MSG_T_STA("rcpi_diff_threshold", br_cur->address->sta->addr,
-				  "exceeded (config=%i) (real=%i)\n",
-				  rcpi_threshold,
-				  br_new->rcpi - br_cur->rcpi);
+		TRACE_ADDR(RCPI_DIFF, si->sta->addr, rcpi_threshold,
+			   br_new->rcpi - br_cur->rcpi);
 	}
 	return is_better;
 }
@@ -95,6 +123,19 @@ has_better_load(struct usteer_node *node_cur, struct usteer_node *node_new)
 	return !below_load_threshold(node_cur) && below_load_threshold(node_new);
 }
 
+static bool
+above_airtime_threshold(struct usteer_node *node)
+{
+	return config.airtime_kick_threshold &&
+	       node->airtime >= config.airtime_kick_threshold;
+}
+
+static bool
+has_better_airtime(struct usteer_node *node_cur, struct usteer_node *node_new)
+{
+	return above_airtime_threshold(node_cur) && !above_airtime_threshold(node_new);
+}
+
 static bool
 below_max_assoc(struct usteer_node *node)
 {
@@ -109,11 +150,13 @@ is_better_candidate(struct sta_info *si_cur, struct sta_info *si_new)
 
 	return below_assoc_threshold(si_cur->node, si_new->node, si_cur) ||
 		   better_signal_strength(si_cur, si_new) ||
-		   has_better_load(si_cur->node, si_new->node);
+		   has_better_load(si_cur->node, si_new->node) ||
+		   has_better_airtime(si_cur->node, si_new->node);
 }
 
 static bool
-is_better_candidate_hearing_map(struct beacon_report *br_cur, struct beacon_report *br_new)
+is_better_candidate_hearing_map(struct sta_info *si, struct beacon_report *br_cur,
+				struct beacon_report *br_new)
 {
 	struct usteer_node *node_new = get_usteer_node_from_bssid(br_new->bssid);
 	struct usteer_node *node_cur = get_usteer_node_from_bssid(br_cur->bssid);
@@ -121,9 +164,10 @@ is_better_candidate_hearing_map(struct beacon_report *br_cur, struct beacon_repo
 	if (!below_max_assoc(node_new))
 		return false;
 
-	return below_assoc_threshold(node_cur, node_new, br_cur->address) ||
-		   better_signal_strength_hearing_map(br_cur, br_new) ||
-		   has_better_load(node_cur, node_new);
+	return below_assoc_threshold(node_cur, node_new, si) ||
+		   better_signal_strength_hearing_map(si, br_cur, br_new) ||
+		   has_better_load(node_cur, node_new) ||
+		   has_better_airtime(node_cur, node_new);
 }
 
 static struct sta_info *
@@ -131,54 +175,66 @@ find_better_candidate(struct sta_info *si_ref)
 {
 	struct sta_info *si;
 	struct sta *sta = si_ref->sta;
-	struct beacon_report *br;
+	struct sta_info_ext *ext = si_ref->ext;
+	struct beacon_report *reports = ext->beacon_reports;
 	struct beacon_report *br_cur = NULL;
+	int i;
 
-	list_for_each_entry(br, &si_ref->beacon_reports, sta_list) {
-		struct usteer_node *node = get_usteer_node_from_bssid(br->bssid);
-		if (!node)
+	for (i = 0; i < ext->n_beacon_reports; i++) {
+		if (usteer_beacon_report_expired(&reports[i]))
 			continue;
-		if (node == si_ref->node) {
-			br_cur = br;
+
+		if (!memcmp(reports[i].bssid, si_ref->node->bssid, sizeof(reports[i].bssid))) {
+			br_cur = &reports[i];
 			break;
 		}
 	}
 
-	list_for_each_entry(br, &si_ref->beacon_reports, sta_list) {
-		if(!br_cur)
-			break;
+	for (i = 0; br_cur && i < ext->n_beacon_reports; i++) {
+		struct beacon_report *br = &reports[i];
+		struct usteer_node *node;
+		bool create;
 
-		struct usteer_node *node = get_usteer_node_from_bssid(br->bssid);
-		if (!node)
+		if (br == br_cur || usteer_beacon_report_expired(br))
 			continue;
-		if (node == si_ref->node)
+
+		node = get_usteer_node_from_bssid(br->bssid);
+		if (!node || node == si_ref->node)
 			continue;
 
-		if (strcmp(node->ssid, si_ref->node->ssid) != 0)
+		if (strcmp(node->ssid, si_ref->node->ssid) != 0 ||
+		    !usteer_rf_graph_is_neighbor(si_ref->node, node))
 			continue;
 
-		bool create;
-		if (is_better_candidate_hearing_map(br_cur, br) &&
-			!is_better_candidate_hearing_map(br, br_cur))
-			return usteer_sta_info_get(br->address->sta, node, &create);
+		if (is_better_candidate_hearing_map(si_ref, br_cur, br) &&
+			!is_better_candidate_hearing_map(si_ref, br, br_cur)) {
+			si = usteer_sta_info_get(sta, node, &create);
+			USTEER_PROBE(candidate, sta->addr, usteer_node_name(si_ref->node),
+				     usteer_node_name(node), true);
+			return si;
+		}
 	}
 
 	list_for_each_entry(si, &sta->nodes, list) {
 		if (si == si_ref)
 			continue;
 
-		if (current_time - si->seen > config.seen_policy_timeout) {
-			MSG_T_STA("seen_policy_timeout", si->sta->addr,
-				"timeout exceeded (%u)\n", config.seen_policy_timeout);
+		if (usteer_sta_info_age(si) > config.seen_policy_timeout) {
+			TRACE_ADDR(SEEN_POLICY_TIMEOUT, si->sta->addr,
+				   config.seen_policy_timeout);
 			continue;
 		}
 
-		if (strcmp(si->node->ssid, si_ref->node->ssid) != 0)
+		if (strcmp(si->node->ssid, si_ref->node->ssid) != 0 ||
+		    !usteer_rf_graph_is_neighbor(si_ref->node, si->node))
 			continue;
 
 		if (is_better_candidate(si_ref, si) &&
-		    !is_better_candidate(si, si_ref))
+		    !is_better_candidate(si, si_ref)) {
+			USTEER_PROBE(candidate, sta->addr, usteer_node_name(si_ref->node),
+				     usteer_node_name(si->node), false);
 			return si;
+		}
 	}
 	return NULL;
 }
@@ -206,9 +262,8 @@ usteer_check_request(struct sta_info *si, enum usteer_event_type type)
 	if (type == EVENT_TYPE_ASSOC)
 		return true;
 
-	if (si->stats[type].blocked_cur >= config.max_retry_band) {
-		MSG_T_STA("max_retry_band", si->sta->addr,
-			"max retry (%u) exceeded\n", config.max_retry_band);
+	if (si->ext->stats[type].blocked_cur >= config.max_retry_band) {
+		TRACE_ADDR(MAX_RETRY_BAND, si->sta->addr, config.max_retry_band);
 		return true;
 	}
 
@@ -218,18 +273,16 @@ usteer_check_request(struct sta_info *si, enum usteer_event_type type)
 			MSG(VERBOSE, "Ignoring %s request from "MAC_ADDR_FMT" due to low signal (%d < %d)\n",
 			    event_types[type], MAC_ADDR_DATA(si->sta->addr),
 			    si->signal, min_signal);
-		MSG_T_STA("min_connect_snr", si->sta->addr,
-			"snr to low (config=%i) (real=%i)\n",
-			min_signal, si->signal);
+		TRACE_ADDR(MIN_CONNECT_SNR, si->sta->addr, min_signal, si->signal);
 		return false;
 	}
 
-	if (current_time - si->created < config.initial_connect_delay) {
+	if (current_time - si->ext->created < config.initial_connect_delay) {
 		if (type != EVENT_TYPE_PROBE || config.debug_level >= MSG_DEBUG)
 			MSG(VERBOSE, "Ignoring %s request from "MAC_ADDR_FMT" during initial connect delay\n",
 			    event_types[type], MAC_ADDR_DATA(si->sta->addr));
-		MSG_T_STA("initial_connect_delay", si->sta->addr,
-			"is below delay (%u)\n", config.initial_connect_delay);
+		TRACE_ADDR(INITIAL_CONNECT_DELAY, si->sta->addr,
+			   config.initial_connect_delay);
 		return false;
 	}
 
@@ -249,31 +302,129 @@ usteer_check_request(struct sta_info *si, enum usteer_event_type type)
 	return false;
 }
 
+/* reduced check for probe-only stations, no other node knows them yet */
+bool
+usteer_check_probe_request(struct usteer_node *node, struct usteer_probe_sta *ps,
+			   int signal)
+{
+	int min_signal;
+
+	if (ps->blocked >= config.max_retry_band) {
+		TRACE_ADDR(MAX_RETRY_BAND, ps->addr, config.max_retry_band);
+		return true;
+	}
+
+	min_signal = snr_to_signal(node, config.min_connect_snr);
+	if (signal != NO_SIGNAL && signal < min_signal) {
+		TRACE_ADDR(MIN_CONNECT_SNR, ps->addr, min_signal, signal);
+		return false;
+	}
+
+	if (current_time - ps->created < config.initial_connect_delay) {
+		TRACE_ADDR(INITIAL_CONNECT_DELAY, ps->addr, config.initial_connect_delay);
+		return false;
+	}
+
+	return true;
+}
+
+static inline struct sta_active_sample *
+active_bytes_sample(struct sta_active_bytes *ab, int age)
+{
+	return &ab->samples[(ab->head + STA_ACTIVE_SAMPLES - age) % STA_ACTIVE_SAMPLES];
+}
+
+/* rate in bits/s between the newest sample and the one <age> samples before */
+static uint64_t
+active_bytes_rate(struct sta_active_bytes *ab, int age)
+{
+	struct sta_active_sample *cur, *prev;
+	uint64_t bytes;
+
+	if (age > ab->count - 1)
+		age = ab->count - 1;
+
+	if (age <= 0)
+		return 0;
+
+	cur = active_bytes_sample(ab, 0);
+	prev = active_bytes_sample(ab, age);
+	if (cur->time <= prev->time)
+		return 0;
+
+	bytes = (cur->rx - prev->rx) + (cur->tx - prev->tx);
+	return bytes * 8 * 1000 / (cur->time - prev->time);
+}
+
+void
+usteer_sta_info_add_active_bytes(struct sta_info *si, uint64_t rx, uint64_t tx)
+{
+	struct sta_active_bytes *ab = &si->ext->active_bytes;
+	struct sta_active_sample *cur;
+	uint64_t rate;
+	int i;
+
+	/* counters went backwards (e.g. after a reassoc), start over */
+	cur = active_bytes_sample(ab, 0);
+	if (ab->count && (rx < cur->rx || tx < cur->tx))
+		ab->count = 0;
+
+	if (ab->count)
+		ab->head = (ab->head + 1) % STA_ACTIVE_SAMPLES;
+	if (ab->count < STA_ACTIVE_SAMPLES)
+		ab->count++;
+
+	cur = active_bytes_sample(ab, 0);
+	cur->time = current_time;
+	cur->rx = rx;
+	cur->tx = tx;
+
+	/* track the highest per-interval rate within the window */
+	ab->peak = 0;
+	for (i = 1; i < ab->count; i++) {
+		struct sta_active_sample *next = active_bytes_sample(ab, i - 1);
+		struct sta_active_sample *prev = active_bytes_sample(ab, i);
+
+		if (next->time <= prev->time)
+			continue;
+
+		rate = ((next->rx - prev->rx) + (next->tx - prev->tx)) * 8 * 1000 /
+		       (next->time - prev->time);
+		if (rate > ab->peak)
+			ab->peak = rate;
+	}
+}
+
 uint64_t
 usteer_get_client_active_bits(struct sta_info *si)
 {
-	struct sta_active_bytes active_bytes = si->active_bytes;
-	uint64_t rx_delta;
-	uint64_t tx_delta;
+	return active_bytes_rate(&si->ext->active_bytes, STA_ACTIVE_SAMPLES - 1);
+}
 
-	rx_delta = active_bytes.data[1][0] - active_bytes.data[0][0];
-	tx_delta = active_bytes.data[1][1] - active_bytes.data[0][1];
-	return ((rx_delta + tx_delta) / config.kick_client_active_sec) * 8;
+uint64_t
+usteer_get_client_burst_bits(struct sta_info *si)
+{
+	return active_bytes_rate(&si->ext->active_bytes, STA_ACTIVE_BURST);
 }
 
 static bool
 is_active_client(struct sta_info *si)
 {
 	uint64_t client_active_ratio = usteer_get_client_active_bits(si);
-	if (client_active_ratio >= config.kick_client_active_bits) {
-		MSG_T("load_kick_active",
-			  "client "MAC_ADDR_FMT" is still active (config=%llu) (real=%llu)",
-			  MAC_ADDR_DATA(si->sta->addr), config.kick_client_active_bits, client_active_ratio);
+	uint64_t client_burst_ratio = usteer_get_client_burst_bits(si);
+
+	/*
+	 * The burst rate covers only the last few seconds, so a call or stream
+	 * that just started is caught before it dominates the window average
+	 */
+	if (client_active_ratio >= config.kick_client_active_bits ||
+	    client_burst_ratio >= config.kick_client_active_bits) {
+		TRACE_ADDR(LOAD_KICK_ACTIVE, si->sta->addr, config.kick_client_active_bits,
+			   client_active_ratio, client_burst_ratio);
 		return true;
 	}
-	MSG_T("load_kick_active",
-		  "client "MAC_ADDR_FMT" is inactive (config=%llu) (real=%llu)",
-		  MAC_ADDR_DATA(si->sta->addr), config.kick_client_active_bits, client_active_ratio);
+	TRACE_ADDR(LOAD_KICK_INACTIVE, si->sta->addr, config.kick_client_active_bits,
+		   client_active_ratio, client_burst_ratio);
 	return false;
 }
 
@@ -283,38 +434,108 @@ is_more_kickable(struct sta_info *si_cur, struct sta_info *si_new)
 	if (!si_cur)
 		return true;
 
-	if (si_new->kick_count > si_cur->kick_count)
+	if (si_new->ext->kick_count > si_cur->ext->kick_count)
 		return false;
 
 	return si_cur->signal > si_new->signal;
 }
 
+/*
+ * Least-squares fit over the signal history. Returns the slope in mdB/s and
+ * the signal projected <time> msecs after the newest sample.
+ */
+bool
+usteer_sta_info_signal_trend(struct sta_info *si, int time, int *slope, int *projected)
+{
+	struct sta_signal_history *sh = &si->ext->signal_history;
+	int64_t sx = 0, sy = 0, sxx = 0, sxy = 0;
+	int64_t n = sh->count;
+	int64_t den, num;
+	int i;
+
+	if (sh->count < STA_SIGNAL_HISTORY / 2)
+		return false;
+
+	for (i = 0; i < sh->count; i++) {
+		int idx = (sh->head + STA_SIGNAL_HISTORY - i) % STA_SIGNAL_HISTORY;
+		int64_t x = (int64_t) sh->time[idx] - (int64_t) sh->time[sh->head];
+		int64_t y = sh->signal[idx];
+
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	den = n * sxx - sx * sx;
+	if (!den)
+		return false;
+
+	num = n * sxy - sx * sy;
+	if (slope)
+		*slope = num * 1000 * 1000 / den;
+	if (projected)
+		*projected = (sy * den - num * sx + n * num * time) / (n * den);
+
+	return true;
+}
+
+static int
+usteer_roam_signal(struct sta_info *si)
+{
+	int projected;
+
+	if (!config.roam_predict_time ||
+	    !usteer_sta_info_signal_trend(si, config.roam_predict_time, NULL, &projected) ||
+	    projected >= si->signal)
+		return si->signal;
+
+	return projected;
+}
+
+#define ROAM_NEAR_MARGIN	6
+
+/* within a few dB of the roam scan/trigger threshold */
+bool
+usteer_sta_info_near_roam(struct sta_info *si)
+{
+	int snr = config.roam_scan_snr ? config.roam_scan_snr : config.roam_trigger_snr;
+
+	if (!snr)
+		return false;
+
+	return si->signal < snr_to_signal(si->node, snr) + ROAM_NEAR_MARGIN;
+}
+
+bool
+usteer_node_congested(struct usteer_node *node)
+{
+	return above_airtime_threshold(node) ||
+	       (config.load_kick_threshold && node->load >= config.load_kick_threshold);
+}
+
 static void
 usteer_roam_set_state(struct sta_info *si, enum roam_trigger_state state)
 {
-	static const char * const state_names[] = {
-#define _S(n) [ROAM_TRIGGER_##n] = #n,
-		__roam_trigger_states
-#undef _S
-	};
-
-	si->roam_event = current_time;
+	si->ext->roam_event = current_time;
 
-	if (si->roam_state == state) {
-		if (si->roam_state == ROAM_TRIGGER_IDLE) {
-			si->roam_tries = 0;
+	if (si->ext->roam_state == state) {
+		if (si->ext->roam_state == ROAM_TRIGGER_IDLE) {
+			si->ext->roam_tries = 0;
 			return;
 		}
 
-		si->roam_tries++;
+		si->ext->roam_tries++;
 	} else {
-		si->roam_tries = 0;
+		si->ext->roam_tries = 0;
+		usteer_metric_inc_idx(&m_roam_transitions, state);
 	}
 
-	si->roam_state = state;
+	si->ext->roam_state = state;
+	TRACE_ADDR(ROAM_STATE, si->sta->addr, state, si->ext->roam_tries, si->signal);
 
 	MSG(VERBOSE, "Roam trigger SM for client "MAC_ADDR_FMT": state=%s, tries=%d, signal=%d\n",
-	    MAC_ADDR_DATA(si->sta->addr), state_names[state], si->roam_tries, si->signal);
+	    MAC_ADDR_DATA(si->sta->addr), roam_trigger_states[state], si->ext->roam_tries, si->signal);
 }
 
 static bool
@@ -325,24 +546,27 @@ usteer_roam_trigger_sm(struct sta_info *si)
 
 	min_signal = snr_to_signal(si->node, config.roam_trigger_snr);
 
-	switch (si->roam_state) {
+	switch (si->ext->roam_state) {
 	case ROAM_TRIGGER_SCAN:
-		if (current_time - si->roam_event < config.roam_scan_interval)
+		if (current_time - si->ext->roam_event < config.roam_scan_interval)
 			break;
 
 		if (find_better_candidate(si) ||
-		    si->roam_scan_done > si->roam_event) {
+		    si->ext->roam_scan_done > si->ext->roam_event) {
 			usteer_roam_set_state(si, ROAM_TRIGGER_SCAN_DONE);
 			break;
 		}
 
-		if (config.roam_scan_tries &&
-		    si->roam_tries >= config.roam_scan_tries) {
+		/* no point in asking clients that never answer for a scan */
+		if ((config.roam_scan_tries &&
+		     si->ext->roam_tries >= config.roam_scan_tries) ||
+		    !usteer_sta_info_beacon_capable(si)) {
 			usteer_roam_set_state(si, ROAM_TRIGGER_WAIT_KICK);
 			break;
 		}
 
 		usteer_ubus_trigger_client_scan(si);
+		usteer_metric_inc(&m_roam_scans);
 		usteer_roam_set_state(si, ROAM_TRIGGER_SCAN);
 		break;
 
@@ -357,7 +581,7 @@ usteer_roam_trigger_sm(struct sta_info *si)
 
 	case ROAM_TRIGGER_SCAN_DONE:
 		/* Check for stale scan results, kick back to SCAN state if necessary */
-		if (current_time - si->roam_scan_done > 2 * config.roam_scan_interval) {
+		if (current_time - si->ext->roam_scan_done > 2 * config.roam_scan_interval) {
 			usteer_roam_set_state(si, ROAM_TRIGGER_SCAN);
 			break;
 		}
@@ -373,17 +597,35 @@ usteer_roam_trigger_sm(struct sta_info *si)
 		if (si->signal > min_signal)
 			break;
 
+		if (!usteer_sta_has_cap(si->sta, STA_CAP_BTM)) {
+			usteer_roam_set_state(si, ROAM_TRIGGER_KICK);
+			break;
+		}
+
+		/* prefer a directed request, the client answers within milliseconds */
 		usteer_roam_set_state(si, ROAM_TRIGGER_NOTIFY_KICK);
-		usteer_ubus_notify_client_disassoc(si);
+		si_new = find_better_candidate(si);
+		if (!si_new || usteer_ubus_bss_transition_request(si, si_new->node))
+			usteer_ubus_notify_client_disassoc(si);
 		break;
 	case ROAM_TRIGGER_NOTIFY_KICK:
-		if (current_time - si->roam_event < config.roam_kick_delay * 100)
+		if (current_time - si->ext->roam_event < config.roam_kick_delay * 100)
 			break;
 
+		if (si->ext->btm.pending) {
+			struct usteer_local_node *ln;
+
+			ln = container_of(si->node, struct usteer_local_node, node);
+			ln->btm.timeout++;
+			usteer_metric_inc_idx(&m_btm_results, BTM_RESULT_TIMEOUT);
+			si->ext->btm.pending = 0;
+		}
+
 		usteer_roam_set_state(si, ROAM_TRIGGER_KICK);
 		break;
 	case ROAM_TRIGGER_KICK:
-		usteer_ubus_kick_client(si);
+		si_new = find_better_candidate(si);
+		usteer_ubus_kick_client(si, STEER_REASON_ROAM, si_new ? si_new->node : NULL);
 		usteer_roam_set_state(si, ROAM_TRIGGER_IDLE);
 		return true;
 	}
@@ -391,6 +633,46 @@ usteer_roam_trigger_sm(struct sta_info *si)
 	return false;
 }
 
+/*
+ * Answer of a client to a directed BSS transition request. A client that
+ * accepts moves on its own, one that rejects is deauthenticated right away
+ * instead of waiting for roam_kick_delay.
+ */
+void usteer_roam_btm_response(struct sta_info *si, uint8_t dialog_token,
+			      uint8_t status, const uint8_t *target)
+{
+	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
+	struct usteer_node *node;
+
+	if (!si->ext->btm.pending || si->ext->btm.dialog_token != dialog_token)
+		return;
+
+	si->ext->btm.pending = 0;
+	if (!target)
+		target = si->ext->btm.target;
+	node = get_usteer_node_from_bssid((uint8_t *) target);
+
+	MSG(VERBOSE, "station "MAC_ADDR_FMT" answered BSS transition request with status %u after %u ms\n",
+	    MAC_ADDR_DATA(si->sta->addr), status, (uint32_t) (current_time - si->ext->btm.time));
+
+	if (status == 0 /* WNM_BSS_TM_ACCEPT */) {
+		ln->btm.accepted++;
+		usteer_metric_inc_idx(&m_btm_results, BTM_RESULT_ACCEPTED);
+		usteer_sta_roam_add(si, STEER_REASON_ROAM, node);
+		si->ext->roam_kick = current_time;
+		usteer_roam_set_state(si, ROAM_TRIGGER_IDLE);
+		return;
+	}
+
+	ln->btm.rejected++;
+	usteer_metric_inc_idx(&m_btm_results, BTM_RESULT_REJECTED);
+	if (si->ext->roam_state != ROAM_TRIGGER_NOTIFY_KICK || !si->connected)
+		return;
+
+	usteer_ubus_kick_client(si, STEER_REASON_ROAM, node);
+	usteer_roam_set_state(si, ROAM_TRIGGER_IDLE);
+}
+
 static void
 usteer_local_node_roam_check(struct usteer_local_node *ln)
 {
@@ -408,8 +690,14 @@ usteer_local_node_roam_check(struct usteer_local_node *ln)
 	min_signal = snr_to_signal(&ln->node, min_signal);
 
 	list_for_each_entry(si, &ln->node.sta_info, node_list) {
-		if (!si->connected || si->signal >= min_signal || is_active_client(si) ||
-		    current_time - si->roam_kick < config.roam_trigger_interval) {
+		/*
+		 * Use the projected signal for clients moving away, so the scan
+		 * starts before they cross the threshold
+		 */
+		if (!si->connected || usteer_roam_signal(si) >= min_signal ||
+		    is_active_client(si) ||
+		    current_time - si->ext->roam_kick < config.roam_trigger_interval ||
+		    usteer_sta_steer_cooldown(si->sta)) {
 			usteer_roam_set_state(si, ROAM_TRIGGER_IDLE);
 			continue;
 		}
@@ -444,14 +732,84 @@ usteer_local_node_snr_kick(struct usteer_local_node *ln)
 		if (si->signal >= min_signal)
 			continue;
 
-		si->kick_count++;
+		if (usteer_sta_steer_cooldown(si->sta))
+			continue;
+
+		si->ext->kick_count++;
 
 		MSG(VERBOSE, "Kicking client "MAC_ADDR_FMT" due to low SNR, signal=%d\n",
 			MAC_ADDR_DATA(si->sta->addr), si->signal);
 
-		usteer_ubus_kick_client(si);
+		usteer_ubus_kick_client(si, STEER_REASON_SNR, NULL);
+		return;
+	}
+}
+
+static bool
+is_slow_client(struct sta_info *si)
+{
+	uint32_t throughput = si->ext->airtime.expected_throughput;
+
+	if (!throughput)
+		throughput = si->ext->airtime.tx_bitrate;
+
+	return throughput && throughput < config.airtime_kick_throughput;
+}
+
+static void
+usteer_local_node_airtime_kick(struct usteer_local_node *ln)
+{
+	struct usteer_node *node = &ln->node;
+	struct sta_info *kick = NULL, *candidate = NULL;
+	struct sta_info *si, *tmp;
+
+	if (!config.airtime_kick_threshold || !config.airtime_kick_throughput)
+		return;
+
+	if (node->airtime < config.airtime_kick_threshold) {
+		ln->airtime_thr_count = 0;
+		return;
+	}
+
+	if (++ln->airtime_thr_count <=
+	    DIV_ROUND_UP(config.airtime_kick_delay, config.local_sta_update))
 		return;
+
+	ln->airtime_thr_count = 0;
+
+	/*
+	 * Pick the slow client occupying the largest share of airtime that has
+	 * somewhere better to go, moving it frees the most airtime for the rest
+	 */
+	list_for_each_entry(si, &node->sta_info, node_list) {
+		if (!si->connected || !is_slow_client(si))
+			continue;
+
+		if (kick && kick->ext->airtime.share >= si->ext->airtime.share)
+			continue;
+
+		if (is_active_client(si) || usteer_sta_steer_cooldown(si->sta))
+			continue;
+
+		tmp = find_better_candidate(si);
+		if (!tmp)
+			continue;
+
+		kick = si;
+		candidate = tmp;
 	}
+
+	if (!kick)
+		return;
+
+	MSG(VERBOSE, "Kicking slow client "MAC_ADDR_FMT" from %s (airtime=%d%%), "
+		"throughput=%u, airtime_share=%u, better_candidate=%s\n",
+		MAC_ADDR_DATA(kick->sta->addr), usteer_node_name(node), node->airtime,
+		kick->ext->airtime.expected_throughput, kick->ext->airtime.share,
+		usteer_node_name(candidate->node));
+
+	kick->ext->kick_count++;
+	usteer_ubus_kick_client(kick, STEER_REASON_AIRTIME, candidate->node);
 }
 
 void
@@ -464,23 +822,22 @@ usteer_local_node_kick(struct usteer_local_node *ln)
 
 	usteer_local_node_roam_check(ln);
 	usteer_local_node_snr_kick(ln);
+	usteer_local_node_airtime_kick(ln);
 
 	if (!config.load_kick_enabled || !config.load_kick_threshold ||
 	    !config.load_kick_delay)
 		return;
 
 	if (node->load < config.load_kick_threshold) {
-		MSG_T("load_kick_threshold",
-			"is below load for this node (config=%i) (real=%i)\n",
-			config.load_kick_threshold, node->load);
+		TRACE_ADDR(LOAD_KICK_THRESHOLD, node->bssid,
+			   config.load_kick_threshold, node->load);
 		ln->load_thr_count = 0;
 		return;
 	}
 
 	if (++ln->load_thr_count <=
 	    DIV_ROUND_UP(config.load_kick_delay, config.local_sta_update)) {
-		MSG_T("load_kick_delay", "delay kicking (config=%i)\n",
-			config.load_kick_delay);
+		TRACE_ADDR(LOAD_KICK_DELAY, node->bssid, config.load_kick_delay);
 		return;
 	}
 
@@ -489,10 +846,8 @@ usteer_local_node_kick(struct usteer_local_node *ln)
 
 	ln->load_thr_count = 0;
 	if (node->n_assoc < config.load_kick_min_clients) {
-		MSG_T("load_kick_min_clients",
-			"min limit reached, stop kicking clients on this node "
-			"(n_assoc=%i) (config=%i)\n",
-			node->n_assoc, config.load_kick_min_clients);
+		TRACE_ADDR(LOAD_KICK_MIN_CLIENTS, node->bssid,
+			   node->n_assoc, config.load_kick_min_clients);
 		return;
 	}
 
@@ -502,7 +857,7 @@ usteer_local_node_kick(struct usteer_local_node *ln)
 		if (!si->connected)
 			continue;
 
-		if (is_active_client(si))
+		if (is_active_client(si) || usteer_sta_steer_cooldown(si->sta))
 			continue;
 
 		if (is_more_kickable(kick1, si))
@@ -528,6 +883,7 @@ usteer_local_node_kick(struct usteer_local_node *ln)
 	    MAC_ADDR_DATA(kick1->sta->addr), kick1->signal,
 		candidate ? usteer_node_name(candidate->node) : "(none)");
 
-	kick1->kick_count++;
-	usteer_ubus_kick_client(kick1);
+	kick1->ext->kick_count++;
+	usteer_ubus_kick_client(kick1, STEER_REASON_LOAD,
+				candidate ? candidate->node : NULL);
 }
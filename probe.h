@@ -0,0 +1,64 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __APMGR_PROBE_H
+#define __APMGR_PROBE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * USDT probes (provider "usteer") for attaching bpftrace or perf to a
+ * running usteerd, e.g.
+ *   bpftrace -e 'usdt:/usr/sbin/usteerd:usteer:kick { printf("%s\n", str(arg1)); }'
+ *
+ * MAC addresses are passed as pointers to 6 bytes, nodes by name and
+ * latencies in microseconds. Without USTEER_USDT a probe compiles to
+ * nothing and its arguments are never evaluated.
+ *
+ *   sta_event(addr, node, event type, freq, signal)
+ *   sta_verdict(addr, node, event type, accepted, latency)
+ *   candidate(addr, current node, new node, from beacon reports)
+ *   kick(addr, node, target node or NULL, steer reason, ubus status, latency)
+ *   remote_rx(peer, interface, id, seq, length)
+ *   remote_tx(interface, seq, length, sendmsg result)
+ *   nl80211_start(request, ifindex)
+ *   nl80211_done(request, result, latency)
+ *   timeout(queue, timeout, lateness in ms)
+ */
+#ifdef USTEER_USDT
+#include <sys/sdt.h>
+
+#define USTEER_PROBE(_name, ...) STAP_PROBEV(usteer, _name, ##__VA_ARGS__)
+
+static inline uint64_t usteer_probe_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#else
+static inline void usteer_probe_nop(int dummy, ...)
+{
+}
+
+#define USTEER_PROBE(_name, ...) \
+	do { if (0) usteer_probe_nop(0, ##__VA_ARGS__); } while (0)
+
+#define usteer_probe_time() 0
+#endif
+
+#endif
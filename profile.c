@@ -0,0 +1,189 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "usteer.h"
+#include "profile.h"
+#include "metrics.h"
+
+/* usecs */
+static const int32_t profile_bounds[] = {
+	100, 1000, 10000, 50000, 100000, 500000, 1000000
+};
+
+#define PROFILE_BUCKETS	(ARRAY_SIZE(profile_bounds) + 1)
+
+struct usteer_profile_stats {
+	uint64_t calls;
+	uint64_t stalls;
+	uint64_t total;
+	uint64_t max;
+	uint64_t runtime[PROFILE_BUCKETS];
+
+	uint64_t timer_calls;
+	uint64_t late_max;
+	uint64_t late[PROFILE_BUCKETS];
+};
+
+static const char * const profile_sites[__PROFILE_MAX] = {
+#define _S(_id, _name) [PROFILE_##_id] = _name,
+	__profile_sites
+#undef _S
+};
+
+static struct usteer_profile_stats profile_stats[__PROFILE_MAX];
+static unsigned int profile_depth;
+static bool profile_stall_logged;
+
+static int64_t usteer_profile_max(unsigned int idx)
+{
+	return profile_stats[idx].max;
+}
+
+USTEER_COUNTER_VEC(m_stalls, "loop_stalls_total",
+		   "Callbacks that blocked the event loop longer than profile_stall_threshold",
+		   "site", profile_sites, __PROFILE_MAX);
+USTEER_GAUGE_VEC_FN(m_max, "loop_runtime_max_usec", "Longest run time of a callback",
+		    "site", profile_sites, __PROFILE_MAX, usteer_profile_max);
+
+static uint64_t usteer_profile_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usteer_profile_observe(uint64_t *buckets, uint64_t val)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(profile_bounds); i++)
+		if (val <= profile_bounds[i])
+			break;
+
+	buckets[i]++;
+}
+
+void usteer_profile_start(struct usteer_profile *p, enum usteer_profile_site site)
+{
+	p->site = site;
+	p->start = 0;
+	if (!config.profile_stall_threshold)
+		return;
+
+	p->start = usteer_profile_time();
+	if (!profile_depth++)
+		profile_stall_logged = false;
+}
+
+void usteer_profile_late(struct usteer_profile *p, int64_t late)
+{
+	struct usteer_profile_stats *s = &profile_stats[p->site];
+
+	if (!p->start)
+		return;
+
+	if (late < 0)
+		late = 0;
+
+	s->timer_calls++;
+	if (late > s->late_max)
+		s->late_max = late;
+	usteer_profile_observe(s->late, late);
+}
+
+/*
+ * Sites nest, a stall is only logged for the innermost site that exceeded
+ * the threshold. The sites around it still count it.
+ */
+void usteer_profile_end(struct usteer_profile *p)
+{
+	struct usteer_profile_stats *s = &profile_stats[p->site];
+	uint64_t runtime;
+
+	if (!p->start)
+		return;
+
+	profile_depth--;
+	runtime = usteer_profile_time() - p->start;
+	s->calls++;
+	s->total += runtime;
+	if (runtime > s->max)
+		s->max = runtime;
+	usteer_profile_observe(s->runtime, runtime);
+
+	if (!config.profile_stall_threshold ||
+	    runtime < (uint64_t) config.profile_stall_threshold * 1000)
+		return;
+
+	s->stalls++;
+	usteer_metric_inc_idx(&m_stalls, p->site);
+	if (profile_stall_logged)
+		return;
+
+	profile_stall_logged = true;
+	MSG(INFO, "Event loop stalled for %u ms in %s\n",
+	    (unsigned int) (runtime / 1000), profile_sites[p->site]);
+}
+
+static void
+usteer_profile_dump_buckets(struct blob_buf *buf, const char *name,
+			    const uint64_t *buckets)
+{
+	uint64_t count = 0;
+	unsigned int i;
+	char le[16];
+	void *c;
+
+	c = blobmsg_open_table(buf, name);
+	for (i = 0; i < PROFILE_BUCKETS; i++) {
+		count += buckets[i];
+		if (i == ARRAY_SIZE(profile_bounds))
+			strcpy(le, "+Inf");
+		else
+			snprintf(le, sizeof(le), "%d", profile_bounds[i]);
+		blobmsg_add_u64(buf, le, count);
+	}
+	blobmsg_close_table(buf, c);
+}
+
+void usteer_profile_dump(struct blob_buf *buf)
+{
+	struct usteer_profile_stats *s;
+	void *c, *t;
+	int i;
+
+	blobmsg_add_u32(buf, "stall_threshold", config.profile_stall_threshold);
+
+	c = blobmsg_open_table(buf, "sites");
+	for (i = 0; i < __PROFILE_MAX; i++) {
+		s = &profile_stats[i];
+		if (!s->calls)
+			continue;
+
+		t = blobmsg_open_table(buf, profile_sites[i]);
+		blobmsg_add_u64(buf, "calls", s->calls);
+		blobmsg_add_u64(buf, "stalls", s->stalls);
+		blobmsg_add_u64(buf, "total", s->total);
+		blobmsg_add_u64(buf, "max", s->max);
+		usteer_profile_dump_buckets(buf, "runtime", s->runtime);
+		if (s->timer_calls) {
+			blobmsg_add_u64(buf, "late_max", s->late_max);
+			usteer_profile_dump_buckets(buf, "late", s->late);
+		}
+		blobmsg_close_table(buf, t);
+	}
+	blobmsg_close_table(buf, c);
+}
@@ -0,0 +1,158 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __APMGR_PROFILE_H
+#define __APMGR_PROFILE_H
+
+#include <libubox/uloop.h>
+#include <libubox/blobmsg.h>
+#include <libubus.h>
+
+#include "timeout.h"
+
+/*
+ * Callback sites of the event loop. Sites nest, everything usteerd does on
+ * behalf of ubus (method calls, hostapd notifications, async replies) also
+ * counts for "ubus".
+ */
+#define __profile_sites \
+	_S(UBUS, "ubus") \
+	_S(HOSTAPD_EVENT, "hostapd_event") \
+	_S(HOSTAPD_CLIENTS, "hostapd_clients") \
+	_S(HOSTAPD_RRM_NR, "hostapd_rrm_nr") \
+	_S(HOSTAPD_REQUEST, "hostapd_request") \
+	_S(NETIFD_STATUS, "netifd_status") \
+	_S(OBJECT_ADD, "object_add") \
+	_S(LOCAL_NODE_UPDATE, "local_node_update") \
+	_S(LOCAL_NODE_STATE, "local_node_state") \
+	_S(NL80211_UPDATE, "nl80211_update") \
+	_S(NL80211_SCAN, "nl80211_scan") \
+	_S(REMOTE_RX, "remote_rx") \
+	_S(REMOTE_UPDATE, "remote_update") \
+	_S(REMOTE_RELOAD, "remote_reload") \
+	_S(VENDOR_UPDATE, "vendor_update") \
+	_S(RF_GRAPH_GC, "rf_graph_gc") \
+	_S(STA_TIMEOUT, "sta_timeout") \
+	_S(STEER_TIMEOUT, "steer_timeout") \
+	_S(PROBE_STA_EXPIRE, "probe_sta_expire") \
+	_S(PROMETHEUS, "prometheus")
+
+enum usteer_profile_site {
+#define _S(_id, _name) PROFILE_##_id,
+	__profile_sites
+#undef _S
+	__PROFILE_MAX
+};
+
+struct usteer_profile {
+	enum usteer_profile_site site;
+	uint64_t start; /* usec, 0 while the profiler is disabled */
+};
+
+void usteer_profile_start(struct usteer_profile *p, enum usteer_profile_site site);
+void usteer_profile_late(struct usteer_profile *p, int64_t late);
+void usteer_profile_end(struct usteer_profile *p);
+void usteer_profile_dump(struct blob_buf *buf);
+
+/*
+ * Each macro defines <cb>_profiled(), which is registered instead of <cb>.
+ * Timers also record how late they fired.
+ */
+#define USTEER_PROFILE_TIMEOUT(_site, _cb)					\
+	static void _cb##_profiled(struct uloop_timeout *t)			\
+	{									\
+		struct usteer_profile p;					\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		usteer_profile_late(&p, (int64_t) p.start -			\
+				    ((int64_t) t->time.tv_sec * 1000000 +	\
+				     t->time.tv_usec));				\
+		_cb(t);								\
+		usteer_profile_end(&p);						\
+	}
+
+#define USTEER_PROFILE_TIMEOUT_QUEUE(_site, _cb)				\
+	static void _cb##_profiled(struct usteer_timeout_queue *q,		\
+				   struct usteer_timeout *t)			\
+	{									\
+		struct usteer_profile p;					\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		usteer_profile_late(&p, (int64_t) 1000 *			\
+				    (int32_t) ((uint32_t) (p.start / 1000) -	\
+					       usteer_timeout_expiry(t)));	\
+		_cb(q, t);							\
+		usteer_profile_end(&p);						\
+	}
+
+#define USTEER_PROFILE_FD(_site, _cb)						\
+	static void _cb##_profiled(struct uloop_fd *u, unsigned int events)	\
+	{									\
+		struct usteer_profile p;					\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		_cb(u, events);							\
+		usteer_profile_end(&p);						\
+	}
+
+#define USTEER_PROFILE_UBUS_HANDLER(_site, _cb)				\
+	static int _cb##_profiled(struct ubus_context *ctx,			\
+				  struct ubus_object *obj,			\
+				  struct ubus_request_data *req,		\
+				  const char *method, struct blob_attr *msg)	\
+	{									\
+		struct usteer_profile p;					\
+		int ret;							\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		ret = _cb(ctx, obj, req, method, msg);				\
+		usteer_profile_end(&p);						\
+		return ret;							\
+	}
+
+#define USTEER_PROFILE_UBUS_DATA(_site, _cb)					\
+	static void _cb##_profiled(struct ubus_request *req, int type,		\
+				   struct blob_attr *msg)			\
+	{									\
+		struct usteer_profile p;					\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		_cb(req, type, msg);						\
+		usteer_profile_end(&p);						\
+	}
+
+#define USTEER_PROFILE_UBUS_COMPLETE(_site, _cb)				\
+	static void _cb##_profiled(struct ubus_request *req, int ret)		\
+	{									\
+		struct usteer_profile p;					\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		_cb(req, ret);							\
+		usteer_profile_end(&p);						\
+	}
+
+#define USTEER_PROFILE_UBUS_EVENT(_site, _cb)					\
+	static void _cb##_profiled(struct ubus_context *ctx,			\
+				   struct ubus_event_handler *ev,		\
+				   const char *type, struct blob_attr *msg)	\
+	{									\
+		struct usteer_profile p;					\
+										\
+		usteer_profile_start(&p, PROFILE_##_site);			\
+		_cb(ctx, ev, type, msg);					\
+		usteer_profile_end(&p);						\
+	}
+
+#endif
@@ -0,0 +1,430 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <libubox/usock.h>
+#include <libubox/ustream.h>
+
+#include "usteer.h"
+#include "node.h"
+#include "metrics.h"
+#include "profile.h"
+#include "mem.h"
+
+#define PROMETHEUS_MAX_CLIENTS	4
+#define PROMETHEUS_TIMEOUT	5000
+#define PROMETHEUS_MAX_REQUEST	4096
+
+struct prometheus_client {
+	struct ustream_fd s;
+	struct uloop_timeout timeout;
+	bool done;
+};
+
+static struct uloop_fd prometheus_fd = { .fd = -1 };
+static char *prometheus_listen;
+static char *prometheus_unix_path;
+static int prometheus_clients;
+
+static const char * const metric_types[] = {
+	[METRIC_COUNTER] = "counter",
+	[METRIC_GAUGE] = "gauge",
+	[METRIC_HISTOGRAM] = "histogram",
+};
+
+/* label values are node names, which come from remote peers */
+static void
+prometheus_write_label(struct ustream *s, const char *name, const char *val)
+{
+	const char *cur;
+
+	ustream_printf(s, "%s=\"", name);
+	for (cur = val; *cur; cur++) {
+		switch (*cur) {
+		case '\\':
+		case '"':
+			ustream_printf(s, "\\%c", *cur);
+			break;
+		case '\n':
+			ustream_write(s, "\\n", 2, true);
+			break;
+		default:
+			ustream_write(s, cur, 1, true);
+			break;
+		}
+	}
+	ustream_write(s, "\"", 1, true);
+}
+
+static void
+prometheus_write_header(struct ustream *s, const char *name, const char *help,
+			const char *type)
+{
+	ustream_printf(s, "# HELP usteer_%s %s\n# TYPE usteer_%s %s\n",
+		       name, help, name, type);
+}
+
+static void
+prometheus_write_histogram(struct ustream *s, struct usteer_metric *m)
+{
+	int64_t count = 0;
+	unsigned int i;
+
+	for (i = 0; i < m->n_bounds; i++) {
+		count += m->values[i];
+		ustream_printf(s, "usteer_%s_bucket{le=\"%d\"} %" PRId64 "\n",
+			       m->name, m->bounds[i], count);
+	}
+	count += m->values[m->n_bounds];
+	ustream_printf(s, "usteer_%s_bucket{le=\"+Inf\"} %" PRId64 "\n", m->name, count);
+	ustream_printf(s, "usteer_%s_sum %" PRId64 "\n", m->name, m->sum);
+	ustream_printf(s, "usteer_%s_count %" PRId64 "\n", m->name, count);
+}
+
+static void
+prometheus_write_metrics(struct ustream *s)
+{
+	struct usteer_metric *m;
+	unsigned int i;
+
+	list_for_each_entry(m, &usteer_metrics, list) {
+		prometheus_write_header(s, m->name, m->help, metric_types[m->type]);
+
+		if (m->type == METRIC_HISTOGRAM) {
+			prometheus_write_histogram(s, m);
+			continue;
+		}
+
+		if (!m->label) {
+			ustream_printf(s, "usteer_%s %" PRId64 "\n", m->name,
+				       usteer_metric_value(m, 0));
+			continue;
+		}
+
+		for (i = 0; i < m->n; i++) {
+			ustream_printf(s, "usteer_%s{", m->name);
+			prometheus_write_label(s, m->label, m->label_values[i]);
+			ustream_printf(s, "} %" PRId64 "\n", usteer_metric_value(m, i));
+		}
+	}
+}
+
+static void
+prometheus_write_node_labels(struct ustream *s, struct usteer_node *node)
+{
+	ustream_write(s, "{", 1, true);
+	prometheus_write_label(s, "node", usteer_node_name(node));
+	ustream_write(s, ",", 1, true);
+	prometheus_write_label(s, "type", node->type == NODE_TYPE_LOCAL ? "local" : "remote");
+	ustream_printf(s, ",freq=\"%d\"}", node->freq);
+}
+
+enum {
+	NODE_METRIC_LOAD,
+	NODE_METRIC_ASSOC,
+	NODE_METRIC_MAX_ASSOC,
+	NODE_METRIC_NOISE,
+	NODE_METRIC_AIRTIME,
+	__NODE_METRIC_MAX
+};
+
+static const struct {
+	const char *name;
+	const char *help;
+} node_metrics[__NODE_METRIC_MAX] = {
+	[NODE_METRIC_LOAD] = { "node_load", "Channel load of a node in percent" },
+	[NODE_METRIC_ASSOC] = { "node_assoc", "Clients associated to a node" },
+	[NODE_METRIC_MAX_ASSOC] = { "node_max_assoc", "Client limit of a node, 0 if unlimited" },
+	[NODE_METRIC_NOISE] = { "node_noise", "Noise floor of a node in dBm" },
+	[NODE_METRIC_AIRTIME] = { "node_airtime", "Airtime used by the clients of a node in percent" },
+};
+
+static int
+prometheus_node_value(struct usteer_node *node, int metric)
+{
+	switch (metric) {
+	case NODE_METRIC_LOAD:
+		return node->load;
+	case NODE_METRIC_ASSOC:
+		return node->n_assoc;
+	case NODE_METRIC_MAX_ASSOC:
+		return node->max_assoc;
+	case NODE_METRIC_NOISE:
+		return node->noise;
+	case NODE_METRIC_AIRTIME:
+		return node->airtime;
+	default:
+		return 0;
+	}
+}
+
+static void
+prometheus_write_nodes(struct ustream *s)
+{
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	int i;
+
+	for (i = 0; i < __NODE_METRIC_MAX; i++) {
+		prometheus_write_header(s, node_metrics[i].name, node_metrics[i].help, "gauge");
+
+		avl_for_each_element(&local_nodes, node, avl) {
+			ustream_printf(s, "usteer_%s", node_metrics[i].name);
+			prometheus_write_node_labels(s, node);
+			ustream_printf(s, " %d\n", prometheus_node_value(node, i));
+		}
+
+		avl_for_each_element(&remote_nodes, rn, avl) {
+			ustream_printf(s, "usteer_%s", node_metrics[i].name);
+			prometheus_write_node_labels(s, &rn->node);
+			ustream_printf(s, " %d\n", prometheus_node_value(&rn->node, i));
+		}
+	}
+
+	prometheus_write_header(s, "remote_node_updates_total",
+				"Updates received for a remote node", "counter");
+	avl_for_each_element(&remote_nodes, rn, avl) {
+		ustream_printf(s, "usteer_remote_node_updates_total{");
+		prometheus_write_label(s, "node", usteer_node_name(&rn->node));
+		ustream_printf(s, ",peer=\"%08lx\"} %u\n",
+			       (unsigned long) rn->avl.key, rn->updates);
+	}
+
+	prometheus_write_header(s, "remote_node_missed_updates",
+				"Update intervals since the last update of a remote node", "gauge");
+	avl_for_each_element(&remote_nodes, rn, avl) {
+		ustream_printf(s, "usteer_remote_node_missed_updates{");
+		prometheus_write_label(s, "node", usteer_node_name(&rn->node));
+		ustream_printf(s, ",peer=\"%08lx\"} %d\n",
+			       (unsigned long) rn->avl.key, rn->check);
+	}
+}
+
+static void
+prometheus_client_close(struct prometheus_client *c)
+{
+	uloop_timeout_cancel(&c->timeout);
+	ustream_free(&c->s.stream);
+	close(c->s.fd.fd);
+	prometheus_clients--;
+	usteer_free(MEM_PROMETHEUS, c);
+}
+
+static void
+prometheus_client_timeout(struct uloop_timeout *t)
+{
+	prometheus_client_close(container_of(t, struct prometheus_client, timeout));
+}
+
+/* the stream must not be freed from within its own callbacks */
+static void
+prometheus_client_close_later(struct prometheus_client *c)
+{
+	uloop_timeout_set(&c->timeout, 1);
+}
+
+static void
+prometheus_client_respond(struct prometheus_client *c, const char *req)
+{
+	struct ustream *s = &c->s.stream;
+	struct usteer_profile p;
+
+	c->done = true;
+	if (strncmp(req, "GET ", 4) != 0) {
+		ustream_printf(s, "HTTP/1.0 405 Method Not Allowed\r\n"
+				  "Allow: GET\r\nConnection: close\r\n\r\n");
+		return;
+	}
+
+	ustream_printf(s, "HTTP/1.0 200 OK\r\n"
+			  "Content-Type: text/plain; version=0.0.4\r\n"
+			  "Connection: close\r\n\r\n");
+
+	/* called from the ustream fd handler, so profiled here */
+	usteer_profile_start(&p, PROFILE_PROMETHEUS);
+	prometheus_write_metrics(s);
+	prometheus_write_nodes(s);
+	usteer_profile_end(&p);
+}
+
+static void
+prometheus_client_notify_read(struct ustream *s, int bytes)
+{
+	struct prometheus_client *c = container_of(s, struct prometheus_client, s.stream);
+	char *buf;
+	int len;
+
+	if (c->done)
+		return;
+
+	buf = ustream_get_read_buf(s, &len);
+	if (!buf)
+		return;
+
+	/* the request itself does not matter, only wait until it is complete */
+	if (!memmem(buf, len, "\r\n\r\n", 4) && !memmem(buf, len, "\n\n", 2)) {
+		if (len >= PROMETHEUS_MAX_REQUEST)
+			prometheus_client_close_later(c);
+		return;
+	}
+
+	buf[len - 1] = 0;
+	prometheus_client_respond(c, buf);
+	ustream_consume(s, len);
+
+	if (!ustream_pending_data(s, true))
+		prometheus_client_close_later(c);
+}
+
+static void
+prometheus_client_notify_write(struct ustream *s, int bytes)
+{
+	struct prometheus_client *c = container_of(s, struct prometheus_client, s.stream);
+
+	if (c->done && !ustream_pending_data(s, true))
+		prometheus_client_close_later(c);
+}
+
+static void
+prometheus_client_notify_state(struct ustream *s)
+{
+	struct prometheus_client *c = container_of(s, struct prometheus_client, s.stream);
+
+	if (s->write_error || (s->eof && !c->done))
+		prometheus_client_close_later(c);
+}
+
+static void
+prometheus_accept(struct uloop_fd *u, unsigned int events)
+{
+	struct prometheus_client *c;
+	int fd;
+
+	while (1) {
+		fd = accept(u->fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		if (prometheus_clients >= PROMETHEUS_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+
+		c = usteer_calloc(MEM_PROMETHEUS, sizeof(*c));
+		c->s.stream.notify_read = prometheus_client_notify_read;
+		c->s.stream.notify_write = prometheus_client_notify_write;
+		c->s.stream.notify_state = prometheus_client_notify_state;
+		c->timeout.cb = prometheus_client_timeout;
+		ustream_fd_init(&c->s, fd);
+		uloop_timeout_set(&c->timeout, PROMETHEUS_TIMEOUT);
+		prometheus_clients++;
+	}
+}
+
+USTEER_PROFILE_FD(PROMETHEUS, prometheus_accept)
+
+static void
+prometheus_stop(void)
+{
+	if (prometheus_fd.fd < 0)
+		return;
+
+	uloop_fd_delete(&prometheus_fd);
+	close(prometheus_fd.fd);
+	prometheus_fd.fd = -1;
+
+	if (prometheus_unix_path) {
+		unlink(prometheus_unix_path);
+		free(prometheus_unix_path);
+		prometheus_unix_path = NULL;
+	}
+}
+
+/* "unix:<path>", "<port>" (on localhost) or "<host>:<port>" */
+static int
+prometheus_start(const char *listen)
+{
+	char *host, *port;
+	int fd;
+
+	if (!strncmp(listen, "unix:", 5)) {
+		unlink(listen + 5);
+		fd = usock(USOCK_UNIX | USOCK_SERVER | USOCK_NONBLOCK, listen + 5, NULL);
+		if (fd >= 0)
+			prometheus_unix_path = strdup(listen + 5);
+	} else {
+		host = strdupa(listen);
+		port = strrchr(host, ':');
+		if (port) {
+			*(port++) = 0;
+			if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+				host[strlen(host) - 1] = 0;
+				host++;
+			}
+		} else {
+			port = host;
+			host = "127.0.0.1";
+		}
+
+		fd = usock(USOCK_TCP | USOCK_SERVER | USOCK_NONBLOCK | USOCK_NUMERIC, host, port);
+	}
+
+	if (fd < 0) {
+		MSG(INFO, "Failed to listen on %s for prometheus\n", listen);
+		return -1;
+	}
+
+	MSG(INFO, "Serving prometheus metrics on %s\n", listen);
+	prometheus_fd.fd = fd;
+	prometheus_fd.cb = prometheus_accept_profiled;
+	uloop_fd_add(&prometheus_fd, ULOOP_READ);
+
+	return 0;
+}
+
+void config_set_prometheus_listen(struct blob_attr *data)
+{
+	const char *val = blobmsg_get_string(data);
+
+	if (prometheus_listen && !strcmp(val, prometheus_listen))
+		return;
+
+	prometheus_stop();
+	free(prometheus_listen);
+	prometheus_listen = NULL;
+
+	if (!strlen(val))
+		return;
+
+	prometheus_listen = strdup(val);
+	prometheus_start(prometheus_listen);
+}
+
+void config_get_prometheus_listen(struct blob_buf *buf)
+{
+	if (!prometheus_listen)
+		return;
+
+	blobmsg_add_string(buf, "prometheus_listen", prometheus_listen);
+}
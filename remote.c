@@ -36,6 +36,12 @@
 #include "usteer.h"
 #include "remote.h"
 #include "node.h"
+#include "hearing_map.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probe.h"
+#include "profile.h"
+#include "mem.h"
 
 static uint32_t local_id;
 static struct uloop_fd remote_fd;
@@ -43,9 +49,22 @@ static struct uloop_timeout remote_timer;
 static struct uloop_timeout reload_timer;
 static struct uloop_timeout vendor_timer;
 
-static struct blob_buf buf;
+USTEER_BLOB_BUF(buf, "remote")
 static uint32_t msg_seq;
 
+enum {
+	REMOTE_RX_ERR_LENGTH,
+	REMOTE_RX_ERR_FORMAT,
+	REMOTE_RX_ERR_INTERFACE,
+	__REMOTE_RX_ERR_MAX
+};
+
+static const char * const remote_rx_errors[__REMOTE_RX_ERR_MAX] = {
+	[REMOTE_RX_ERR_LENGTH] = "length",
+	[REMOTE_RX_ERR_FORMAT] = "format",
+	[REMOTE_RX_ERR_INTERFACE] = "interface",
+};
+
 struct interface {
 	struct vlist_node node;
 	int ifindex;
@@ -67,6 +86,22 @@ static int remote_node_cmp(const void *k1, const void *k2, void *ptr)
 static VLIST_TREE(interfaces, avl_strcmp, interfaces_update_cb, true, true);
 AVL_TREE(remote_nodes, remote_node_cmp, true, NULL);
 
+static int64_t usteer_remote_node_count(unsigned int idx)
+{
+	return remote_nodes.count;
+}
+
+USTEER_GAUGE_FN(m_remote_nodes, "remote_nodes", "Remote nodes",
+		usteer_remote_node_count);
+USTEER_COUNTER(m_rx, "remote_rx_total", "Messages received from other instances");
+USTEER_COUNTER_VEC(m_rx_errors, "remote_rx_errors_total",
+		   "Received messages that were dropped", "reason",
+		   remote_rx_errors, __REMOTE_RX_ERR_MAX);
+USTEER_COUNTER(m_tx, "remote_tx_total", "Messages sent to other instances");
+USTEER_COUNTER(m_tx_errors, "remote_tx_errors_total", "Messages that could not be sent");
+USTEER_HISTOGRAM(m_msg_size, "remote_msg_bytes", "Size of sent and received messages",
+		 256, 512, 1024, 2048, 4096, 8192, 16384);
+
 static const char *
 interface_name(struct interface *iface)
 {
@@ -90,7 +125,7 @@ static void
 interface_free(struct interface *iface)
 {
 	avl_delete(&interfaces.avl, &iface->node.avl);
-	free(iface);
+	usteer_free(MEM_INTERFACE, iface);
 }
 
 static void
@@ -102,7 +137,7 @@ interfaces_update_cb(struct vlist_tree *tree,
 
 	if (node_new && node_old) {
 		iface = container_of(node_new, struct interface, node);
-		free(iface);
+		usteer_free(MEM_INTERFACE, iface);
 		iface = container_of(node_old, struct interface, node);
 		interface_check(iface);
 	} else if (node_old) {
@@ -119,7 +154,7 @@ void usteer_interface_add(const char *name)
 	struct interface *iface;
 	char *name_buf;
 
-	iface = calloc_a(sizeof(*iface), &name_buf, strlen(name) + 1);
+	iface = usteer_calloc_a(MEM_INTERFACE, sizeof(*iface), &name_buf, strlen(name) + 1);
 	strcpy(name_buf, name);
 	vlist_add(&interfaces, &iface->node, name_buf);
 }
@@ -158,6 +193,7 @@ interface_add_station(struct usteer_remote_node *node, struct blob_attr *data)
 	struct sta_info *si;
 	struct apmsg_sta msg;
 	bool create;
+	int i;
 
 	if (!parse_apmsg_sta(&msg, data)) {
 		MSG(DEBUG, "Cannot parse station in message\n");
@@ -177,7 +213,41 @@ interface_add_station(struct usteer_remote_node *node, struct blob_attr *data)
 	if (!si)
 		return;
 
+	for (i = 0; i < msg.n_roam_history; i++) {
+		const struct apmsg_roam_entry *re = &msg.roam_history[i];
+		struct sta_roam_entry e = {
+			.reason = re->reason,
+			.reverted = re->reverted,
+			.time = current_time - be32_to_cpu(re->age),
+		};
+
+		if (e.reason >= __STEER_REASON_MAX)
+			continue;
+
+		memcpy(e.from, re->from, sizeof(e.from));
+		memcpy(e.to, re->to, sizeof(e.to));
+		usteer_sta_roam_merge(sta, &e);
+	}
+
+	for (i = 0; i < msg.n_hearing_map; i++) {
+		const struct apmsg_beacon_report *hm = &msg.hearing_map[i];
+		struct beacon_report br = {
+			.rcpi = hm->rcpi,
+			.rsni = hm->rsni,
+			.op_class = hm->op_class,
+			.channel = hm->channel,
+			.usteer_time = current_time - be32_to_cpu(hm->age),
+		};
+
+		memcpy(br.bssid, hm->bssid, sizeof(br.bssid));
+		usteer_beacon_report_merge(sta, &br);
+	}
+
+	if (msg.connected && !si->connected)
+		usteer_sta_info_assoc(si);
+
 	si->connected = msg.connected;
+	/* already filtered by the sending node */
 	si->signal = msg.signal;
 	si->seen = current_time - msg.seen;
 	usteer_sta_info_update_timeout(si, msg.timeout);
@@ -188,7 +258,7 @@ remote_node_free(struct usteer_remote_node *node)
 {
 	avl_delete(&remote_nodes, &node->avl);
 	usteer_sta_node_cleanup(&node->node);
-	free(node);
+	usteer_free(MEM_REMOTE_NODE, node);
 }
 
 static struct usteer_remote_node *
@@ -206,7 +276,8 @@ interface_get_node(const char *addr, unsigned long id, const char *name)
 		node = avl_next_element(node, avl);
 	}
 
-	node = calloc_a(sizeof(*node), &buf, addr_len + 1 + strlen(name) + 1);
+	node = usteer_calloc_a(MEM_REMOTE_NODE, sizeof(*node), &buf,
+			       addr_len + 1 + strlen(name) + 1);
 	node->avl.key = (void *) id;
 	node->node.type = NODE_TYPE_REMOTE;
 
@@ -237,14 +308,17 @@ interface_add_node(struct interface *iface, const char *addr, unsigned long id,
 
 	node = interface_get_node(addr, id, msg.name);
 	node->check = 0;
+	node->updates++;
 	node->node.freq = msg.freq;
 	node->node.n_assoc = msg.n_assoc;
 	node->node.max_assoc = msg.max_assoc;
 	node->node.noise = msg.noise;
 	node->node.load = msg.load;
+	node->node.airtime = msg.airtime;
 	node->iface = iface;
 	snprintf(node->node.ssid, sizeof(node->node.ssid), "%s", msg.ssid);
-	usteer_node_set_blob(&node->node.rrm_nr, msg.rrm_nr);
+	if (usteer_node_set_blob(&node->node.rrm_nr, msg.rrm_nr))
+		usteer_local_node_rrm_nr_dirty(NULL);
 	usteer_node_set_blob(&node->node.script_data, msg.script_data);
 
 	uint8_t *bssid = (uint8_t *) ether_aton(msg.bssid);
@@ -265,21 +339,27 @@ interface_recv_msg(struct interface *iface, struct in6_addr *addr, void *buf, in
 
 	if (blob_pad_len(data) != len) {
 		MSG(DEBUG, "Invalid message length (header: %d, real: %d)\n", blob_pad_len(data), len);
+		usteer_metric_inc_idx(&m_rx_errors, REMOTE_RX_ERR_LENGTH);
 		return;
 	}
 
 	if (!parse_apmsg(&msg, data)) {
 		MSG(DEBUG, "Missing fields in message\n");
+		usteer_metric_inc_idx(&m_rx_errors, REMOTE_RX_ERR_FORMAT);
 		return;
 	}
 
 	if (msg.id == local_id)
 		return;
 
+	usteer_metric_inc(&m_rx);
+	usteer_metric_observe(&m_msg_size, len);
+
 	MSG(NETWORK, "Received message on %s (id=%08x->%08x seq=%d len=%d)\n",
 		interface_name(iface), msg.id, local_id, msg.seq, len);
 
 	inet_ntop(AF_INET6, addr, addr_str, sizeof(addr_str));
+	USTEER_PROBE(remote_rx, addr_str, interface_name(iface), msg.id, msg.seq, len);
 
 	blob_for_each_attr(cur, msg.nodes, rem)
 		interface_add_node(iface, addr_str, msg.id, cur);
@@ -338,6 +418,7 @@ interface_recv(struct uloop_fd *u, unsigned int events)
 			iface = interface_find_by_ifindex(sin.sin6_scope_id);
 			if (!iface) {
 				MSG(DEBUG, "Received packet from unconfigured interface %d\n", sin.sin6_scope_id);
+				usteer_metric_inc_idx(&m_rx_errors, REMOTE_RX_ERR_INTERFACE);
 				continue;
 			}
 
@@ -346,6 +427,8 @@ interface_recv(struct uloop_fd *u, unsigned int events)
 	}
 }
 
+USTEER_PROFILE_FD(REMOTE_RX, interface_recv)
+
 static void
 interface_send_msg(struct interface *iface, struct blob_attr *data)
 {
@@ -361,6 +444,7 @@ interface_send_msg(struct interface *iface, struct blob_attr *data)
 		.msg_controllen = CMSG_LEN(sizeof(struct in6_pktinfo)),
 	};
 	struct cmsghdr *cmsg;
+	int ret;
 
 	a.sin6_family = AF_INET6;
 	a.sin6_port = htons(APMGR_PORT);
@@ -377,14 +461,76 @@ interface_send_msg(struct interface *iface, struct blob_attr *data)
 	iov.iov_base = data;
 	iov.iov_len = blob_pad_len(data);
 	if(!config.remote_disabled){
-		if (sendmsg(remote_fd.fd, &m, 0) < 0)
+		usteer_metric_inc(&m_tx);
+		usteer_metric_observe(&m_msg_size, iov.iov_len);
+		ret = sendmsg(remote_fd.fd, &m, 0);
+		USTEER_PROBE(remote_tx, interface_name(iface), msg_seq, iov.iov_len, ret);
+		if (ret < 0) {
 			perror("sendmsg");
+			usteer_metric_inc(&m_tx_errors);
+		}
+	}
+}
+
+static void usteer_send_roam_history(struct sta *sta)
+{
+	struct apmsg_roam_entry *re;
+	struct sta_roam_entry *e = usteer_sta_roam_last(sta);
+	int i;
+
+	/* only share history that can still mark a steer as reverted */
+	if (!e || current_time - e->time > config.steer_revert_timeout)
+		return;
+
+	re = blob_data(blob_new(&buf, APMSG_STA_ROAM_HISTORY, sta->roam_count * sizeof(*re)));
+	for (i = 0; i < sta->roam_count; i++) {
+		e = &sta->roam_history[(sta->roam_head + 1 + i +
+					STA_ROAM_HISTORY - sta->roam_count) % STA_ROAM_HISTORY];
+		memcpy(re[i].from, e->from, sizeof(re[i].from));
+		memcpy(re[i].to, e->to, sizeof(re[i].to));
+		re[i].reason = e->reason;
+		re[i].reverted = e->reverted;
+		re[i].age = cpu_to_be32(current_time - e->time);
+	}
+}
+
+/*
+ * Share the beacon reports of a local station, so its next node can pick
+ * a candidate right away. Only sent when the client answered a beacon
+ * request since the last update, at most once per hearing_map_share_interval.
+ */
+static void usteer_send_hearing_map(struct sta_info *si)
+{
+	struct sta_info_ext *ext = si->ext;
+	struct apmsg_beacon_report *hm;
+	struct beacon_report *br;
+	int i;
+
+	if (!ext || !config.hearing_map_share_interval ||
+	    ext->beacon_request.lastReportTime <= ext->hearing_map_sent ||
+	    current_time - ext->hearing_map_sent < config.hearing_map_share_interval)
+		return;
+
+	usteer_beacon_report_expire(si);
+	if (!ext->n_beacon_reports)
+		return;
+
+	ext->hearing_map_sent = current_time;
+	hm = blob_data(blob_new(&buf, APMSG_STA_HEARING_MAP, ext->n_beacon_reports * sizeof(*hm)));
+	for (i = 0; i < ext->n_beacon_reports; i++) {
+		br = &ext->beacon_reports[i];
+		memcpy(hm[i].bssid, br->bssid, sizeof(hm[i].bssid));
+		hm[i].rcpi = br->rcpi;
+		hm[i].rsni = br->rsni;
+		hm[i].op_class = br->op_class;
+		hm[i].channel = br->channel;
+		hm[i].age = cpu_to_be32(current_time - br->usteer_time);
 	}
 }
 
 static void usteer_send_sta_info(struct sta_info *sta)
 {
-	int seen = current_time - sta->seen;
+	int seen = usteer_sta_info_age(sta);
 	void *c;
 
 	c = blob_nest_start(&buf, 0);
@@ -393,6 +539,8 @@ static void usteer_send_sta_info(struct sta_info *sta)
 	blob_put_int32(&buf, APMSG_STA_SIGNAL, sta->signal);
 	blob_put_int32(&buf, APMSG_STA_SEEN, seen);
 	blob_put_int32(&buf, APMSG_STA_TIMEOUT, config.local_sta_timeout - seen);
+	usteer_send_roam_history(sta->sta);
+	usteer_send_hearing_map(sta);
 	blob_nest_end(&buf, c);
 }
 
@@ -408,6 +556,7 @@ static void usteer_send_node(struct usteer_node *node, struct sta_info *sta)
 	blob_put_int32(&buf, APMSG_NODE_FREQ, node->freq);
 	blob_put_int32(&buf, APMSG_NODE_NOISE, node->noise);
 	blob_put_int32(&buf, APMSG_NODE_LOAD, node->load);
+	blob_put_int32(&buf, APMSG_NODE_AIRTIME, node->airtime);
 	blob_put_int32(&buf, APMSG_NODE_N_ASSOC, node->n_assoc);
 	blob_put_int32(&buf, APMSG_NODE_MAX_ASSOC, node->max_assoc);
 	if (node->rrm_nr) {
@@ -485,8 +634,7 @@ usteer_send_update_timer(struct uloop_timeout *t)
 	struct usteer_node *node;
 	void *c;
 
-	MSG_T("remote_update_interval", "start remote update (interval=%u)\n",
-		config.remote_update_interval);
+	TRACE(REMOTE_UPDATE, config.remote_update_interval);
 
 	usteer_update_time();
 	uloop_timeout_set(t, config.remote_update_interval);
@@ -499,6 +647,8 @@ usteer_send_update_timer(struct uloop_timeout *t)
 	usteer_check_timeout();
 }
 
+USTEER_PROFILE_TIMEOUT(REMOTE_UPDATE, usteer_send_update_timer)
+
 static int
 usteer_init_local_id(void)
 {
@@ -545,10 +695,12 @@ usteer_reload_timer(struct uloop_timeout *t)
 	}
 
 	remote_fd.fd = fd;
-	remote_fd.cb = interface_recv;
+	remote_fd.cb = interface_recv_profiled;
 	uloop_fd_add(&remote_fd, ULOOP_READ);
 }
 
+USTEER_PROFILE_TIMEOUT(REMOTE_RELOAD, usteer_reload_timer)
+
 static char hex[] = "0123456789ABCDEF";
 static void convert_to_hex_string(char *str, const uint8_t *val, size_t count)
 {
@@ -625,8 +777,7 @@ usteer_vendor_set()
 static void
 usteer_vendor_update_timer(struct uloop_timeout *t)
 {
-	MSG_T("vendor_update_interval", "start vendor update (interval=%u)\n",
-		  config.vendor_update_interval);
+	TRACE(VENDOR_UPDATE, config.vendor_update_interval);
 
 	usteer_update_time();
 	uloop_timeout_set(t, config.vendor_update_interval);
@@ -634,19 +785,21 @@ usteer_vendor_update_timer(struct uloop_timeout *t)
 	usteer_vendor_set();
 }
 
+USTEER_PROFILE_TIMEOUT(VENDOR_UPDATE, usteer_vendor_update_timer)
+
 
 int usteer_interface_init(void)
 {
 	if (usteer_init_local_id())
 		return -1;
 
-	remote_timer.cb = usteer_send_update_timer;
+	remote_timer.cb = usteer_send_update_timer_profiled;
 	remote_timer.cb(&remote_timer);
 
-	reload_timer.cb = usteer_reload_timer;
+	reload_timer.cb = usteer_reload_timer_profiled;
 	reload_timer.cb(&reload_timer);
 
-	vendor_timer.cb = usteer_vendor_update_timer;
+	vendor_timer.cb = usteer_vendor_update_timer_profiled;
 	vendor_timer.cb(&vendor_timer);
 
 	return 0;
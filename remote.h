@@ -47,6 +47,7 @@ enum {
 	APMSG_NODE_MAX_ASSOC,
 	APMSG_NODE_RRM_NR,
 	APMSG_NODE_SCRIPT_DATA,
+	APMSG_NODE_AIRTIME,
 	__APMSG_NODE_MAX
 };
 
@@ -59,6 +60,7 @@ struct apmsg_node {
 	int max_assoc;
 	int noise;
 	int load;
+	int airtime;
 	struct blob_attr *stations;
 	struct blob_attr *rrm_nr;
 	struct blob_attr *script_data;
@@ -70,9 +72,30 @@ enum {
 	APMSG_STA_TIMEOUT,
 	APMSG_STA_SEEN,
 	APMSG_STA_CONNECTED,
+	APMSG_STA_ROAM_HISTORY,
+	APMSG_STA_HEARING_MAP,
 	__APMSG_STA_MAX
 };
 
+/* APMSG_STA_ROAM_HISTORY is an array of these, oldest first */
+struct apmsg_roam_entry {
+	uint8_t from[6];
+	uint8_t to[6];
+	uint8_t reason;
+	uint8_t reverted;
+	uint32_t age; /* msecs, big endian */
+} __packed;
+
+/* APMSG_STA_HEARING_MAP is an array of these, best RCPI first */
+struct apmsg_beacon_report {
+	uint8_t bssid[6];
+	uint8_t rcpi;
+	uint8_t rsni;
+	uint8_t op_class;
+	uint8_t channel;
+	uint32_t age; /* msecs, big endian */
+} __packed;
+
 struct apmsg_sta {
 	uint8_t addr[6];
 
@@ -80,6 +103,12 @@ struct apmsg_sta {
 	int signal;
 	int timeout;
 	int seen;
+
+	const struct apmsg_roam_entry *roam_history;
+	int n_roam_history;
+
+	const struct apmsg_beacon_report *hearing_map;
+	int n_hearing_map;
 };
 
 bool parse_apmsg(struct apmsg *msg, struct blob_attr *data);
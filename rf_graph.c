@@ -0,0 +1,353 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <net/ethernet.h>
+#include <netinet/ether.h>
+
+#include "usteer.h"
+#include "node.h"
+#include "hearing_map.h"
+#include "rf_graph.h"
+#include "profile.h"
+#include "mem.h"
+
+#define RF_GRAPH_GC_INTERVAL	(10 * 60 * 1000)
+#define RF_SCAN_MAX_FREQ	16
+
+static int
+avl_rf_edge_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return memcmp(k1, k2, 12);
+}
+
+AVL_TREE(rf_edges, avl_rf_edge_cmp, false, NULL);
+static struct uloop_timeout rf_graph_gc_timer;
+
+static void
+usteer_rf_graph_gc(struct uloop_timeout *t)
+{
+	struct usteer_rf_edge *e, *tmp;
+
+	usteer_update_time();
+	avl_for_each_element_safe(&rf_edges, e, avl, tmp) {
+		if (current_time - e->seen < RF_EDGE_TIMEOUT)
+			continue;
+
+		usteer_local_node_rrm_nr_dirty(e->from);
+		avl_delete(&rf_edges, &e->avl);
+		usteer_free(MEM_RF_EDGE, e);
+	}
+
+	if (!avl_is_empty(&rf_edges))
+		uloop_timeout_set(t, RF_GRAPH_GC_INTERVAL);
+}
+
+USTEER_PROFILE_TIMEOUT(RF_GRAPH_GC, usteer_rf_graph_gc)
+
+static struct usteer_rf_edge *
+usteer_rf_edge_get(const uint8_t *from, const uint8_t *to)
+{
+	struct usteer_rf_edge *e;
+	uint8_t key[12];
+
+	memcpy(key, from, 6);
+	memcpy(key + 6, to, 6);
+	e = avl_find_element(&rf_edges, key, e, avl);
+	if (e)
+		return e;
+
+	e = usteer_calloc(MEM_RF_EDGE, sizeof(*e));
+	memcpy(e->from, from, sizeof(e->from));
+	memcpy(e->to, to, sizeof(e->to));
+	e->avl.key = e->from;
+	avl_insert(&rf_edges, &e->avl);
+
+	if (!rf_graph_gc_timer.pending)
+		uloop_timeout_set(&rf_graph_gc_timer, RF_GRAPH_GC_INTERVAL);
+
+	return e;
+}
+
+static void
+usteer_rf_edge_delta(struct usteer_rf_edge *e, int delta)
+{
+	delta *= 256;
+	if (e->have_delta)
+		e->rcpi_delta += (delta - e->rcpi_delta) / 8;
+	else
+		e->rcpi_delta = delta;
+	e->have_delta = true;
+}
+
+/* record that <a> and <b> were heard together, rcpi values < 0 if unknown */
+static void
+usteer_rf_graph_observe(const uint8_t *a, int rcpi_a, const uint8_t *b, int rcpi_b)
+{
+	struct usteer_rf_edge *ab, *ba;
+
+	if (!memcmp(a, b, 6))
+		return;
+
+	ab = usteer_rf_edge_get(a, b);
+	ba = usteer_rf_edge_get(b, a);
+	ab->count++;
+	ba->count++;
+	ab->seen = ba->seen = current_time;
+	usteer_local_node_rrm_nr_dirty(a);
+	usteer_local_node_rrm_nr_dirty(b);
+
+	if (rcpi_a < 0 || rcpi_b < 0)
+		return;
+
+	usteer_rf_edge_delta(ab, rcpi_b - rcpi_a);
+	usteer_rf_edge_delta(ba, rcpi_a - rcpi_b);
+}
+
+/*
+ * A beacon report shows the reported node to be audible together with the
+ * node the client is associated to, and with the nodes the client reported
+ * in answer to the same beacon request. Called before the report is added
+ * to the hearing map, so every pair is counted once per client and request;
+ * a node reported twice in one round is only counted the first time.
+ */
+void usteer_rf_graph_beacon_report(struct sta_info *si, struct beacon_report *br)
+{
+	struct sta_info_ext *ext = si->ext;
+	uint64_t round = ext->beacon_request.lastRequestTime;
+	struct beacon_report *cur;
+	bool own = false;
+	int i;
+
+	for (i = 0; i < ext->n_beacon_reports; i++) {
+		cur = &ext->beacon_reports[i];
+		if (!memcmp(cur->bssid, br->bssid, sizeof(cur->bssid)) &&
+		    cur->usteer_time >= round)
+			return;
+	}
+
+	for (i = 0; i < ext->n_beacon_reports; i++) {
+		cur = &ext->beacon_reports[i];
+		if (!memcmp(cur->bssid, br->bssid, sizeof(cur->bssid)) ||
+		    cur->usteer_time < round || usteer_beacon_report_expired(cur))
+			continue;
+
+		if (!memcmp(cur->bssid, si->node->bssid, sizeof(cur->bssid)))
+			own = true;
+
+		usteer_rf_graph_observe(cur->bssid, cur->rcpi, br->bssid, br->rcpi);
+	}
+
+	if (!own)
+		usteer_rf_graph_observe(si->node->bssid, -1, br->bssid, br->rcpi);
+}
+
+static void
+usteer_rf_graph_scan_cb(void *priv, struct usteer_scan_result *r)
+{
+	struct usteer_node *node = priv;
+	struct usteer_rf_edge *e;
+
+	if (!get_usteer_node_from_bssid(r->bssid))
+		return;
+
+	usteer_rf_graph_observe(node->bssid, -1, r->bssid, -1);
+	e = usteer_rf_edge_get(node->bssid, r->bssid);
+	e->scan_signal = r->signal;
+}
+
+static void
+usteer_rf_graph_scan_freq(struct usteer_scan_request *req, struct usteer_node *ln,
+			  struct usteer_node *node)
+{
+	int i;
+
+	if (!node->freq || strcmp(node->ssid, ln->ssid) != 0 ||
+	    req->n_freq >= RF_SCAN_MAX_FREQ)
+		return;
+
+	for (i = 0; i < req->n_freq; i++)
+		if (req->freq[i] == node->freq)
+			return;
+
+	req->freq[req->n_freq++] = node->freq;
+}
+
+/*
+ * Scan for the other nodes from a local node every rf_scan_interval.
+ * This takes the radio off channel, so it is disabled by default.
+ */
+void usteer_rf_graph_scan(struct usteer_local_node *ln)
+{
+	struct usteer_scan_request req = {
+		.passive = true,
+	};
+	struct usteer_node_handler *h;
+	struct usteer_remote_node *rn;
+	struct usteer_node *node;
+	int freq[RF_SCAN_MAX_FREQ];
+
+	if (!config.rf_scan_interval ||
+	    current_time - ln->rf_scan_time < config.rf_scan_interval)
+		return;
+
+	ln->rf_scan_time = current_time;
+
+	req.freq = freq;
+	avl_for_each_element(&local_nodes, node, avl)
+		usteer_rf_graph_scan_freq(&req, &ln->node, node);
+	avl_for_each_element(&remote_nodes, rn, avl)
+		usteer_rf_graph_scan_freq(&req, &ln->node, &rn->node);
+
+	list_for_each_entry(h, &node_handlers, list) {
+		if (!h->scan)
+			continue;
+
+		MSG(DEBUG, "scanning %d frequencies from node %s\n",
+		    req.n_freq, usteer_node_name(&ln->node));
+		if (!h->scan(&ln->node, &req, &ln->node, usteer_rf_graph_scan_cb))
+			break;
+	}
+}
+
+/*
+ * Rank of <cand> as neighbor of <node>: the number of times both were heard
+ * together, plus the signal strength above -100 dBm if <node> scanned it.
+ */
+uint32_t usteer_rf_graph_score(struct usteer_node *node, struct usteer_node *cand)
+{
+	struct usteer_rf_edge *e;
+	uint8_t key[12];
+	uint32_t score;
+
+	memcpy(key, node->bssid, 6);
+	memcpy(key + 6, cand->bssid, 6);
+	e = avl_find_element(&rf_edges, key, e, avl);
+	if (!e)
+		return 0;
+
+	score = e->count;
+	if (e->scan_signal && e->scan_signal > -100)
+		score += e->scan_signal + 100;
+
+	return score;
+}
+
+/*
+ * Walk the edges from <node> that were seen at least rf_neighbor_min_count
+ * times. Returns true if <cand> is one of them, <known> is set if there is
+ * any.
+ */
+static bool
+usteer_rf_graph_find_neighbor(struct usteer_node *node, struct usteer_node *cand,
+			      bool *known)
+{
+	struct usteer_rf_edge *e;
+	uint8_t key[12];
+
+	*known = false;
+	memcpy(key, node->bssid, 6);
+	memset(key + 6, 0, 6);
+	e = avl_find_ge_element(&rf_edges, key, e, avl);
+	if (!e)
+		return false;
+
+	avl_for_element_to_last(&rf_edges, e, e, avl) {
+		if (memcmp(e->from, node->bssid, sizeof(e->from)) != 0)
+			break;
+
+		if (e->count < config.rf_neighbor_min_count)
+			continue;
+
+		*known = true;
+		if (cand && !memcmp(e->to, cand->bssid, sizeof(e->to)))
+			return true;
+	}
+
+	return false;
+}
+
+bool usteer_rf_graph_has_neighbors(struct usteer_node *node)
+{
+	bool known;
+
+	usteer_rf_graph_find_neighbor(node, NULL, &known);
+
+	return known;
+}
+
+/*
+ * Candidates of a node are limited to its RF neighbors, i.e. nodes seen
+ * together with it at least rf_neighbor_min_count times. Nodes that do not
+ * have any confirmed neighbor yet are not restricted.
+ */
+bool usteer_rf_graph_is_neighbor(struct usteer_node *node, struct usteer_node *cand)
+{
+	bool known;
+
+	if (!config.rf_neighbor_min_count)
+		return true;
+
+	if (usteer_rf_graph_find_neighbor(node, cand, &known))
+		return true;
+
+	return !known;
+}
+
+void usteer_rf_graph_dump(struct blob_buf *buf)
+{
+	struct usteer_rf_edge *e;
+	struct usteer_node *node;
+	uint8_t *from = NULL;
+	void *c, *n = NULL, *t = NULL, *r;
+
+	c = blobmsg_open_table(buf, "nodes");
+	avl_for_each_element(&rf_edges, e, avl) {
+		if (!from || memcmp(from, e->from, sizeof(e->from)) != 0) {
+			if (from) {
+				blobmsg_close_table(buf, t);
+				blobmsg_close_table(buf, n);
+			}
+			from = e->from;
+			n = blobmsg_open_table(buf, ether_ntoa((struct ether_addr *) e->from));
+			node = get_usteer_node_from_bssid(e->from);
+			if (node)
+				blobmsg_add_string(buf, "node", usteer_node_name(node));
+			t = blobmsg_open_table(buf, "neighbors");
+		}
+
+		r = blobmsg_open_table(buf, ether_ntoa((struct ether_addr *) e->to));
+		node = get_usteer_node_from_bssid(e->to);
+		if (node)
+			blobmsg_add_string(buf, "node", usteer_node_name(node));
+		blobmsg_add_u32(buf, "count", e->count);
+		if (e->have_delta)
+			blobmsg_add_u32(buf, "rcpi_delta", e->rcpi_delta / 256);
+		if (e->scan_signal)
+			blobmsg_add_u32(buf, "scan_signal", e->scan_signal);
+		blobmsg_add_u32(buf, "age", current_time - e->seen);
+		blobmsg_add_u8(buf, "neighbor", e->count >= config.rf_neighbor_min_count);
+		blobmsg_close_table(buf, r);
+	}
+	if (from) {
+		blobmsg_close_table(buf, t);
+		blobmsg_close_table(buf, n);
+	}
+	blobmsg_close_table(buf, c);
+}
+
+static void __usteer_init usteer_rf_graph_init(void)
+{
+	rf_graph_gc_timer.cb = usteer_rf_graph_gc_profiled;
+}
@@ -0,0 +1,51 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __APMGR_RF_GRAPH_H
+#define __APMGR_RF_GRAPH_H
+
+#include "usteer.h"
+#include "node.h"
+
+/* edges not confirmed for this long are dropped */
+#define RF_EDGE_TIMEOUT		(24 * 60 * 60 * 1000)
+
+/*
+ * Directed edge between two nodes (by bssid) that were heard together,
+ * stored in both directions so all neighbors of a node are adjacent in the tree.
+ */
+struct usteer_rf_edge {
+	struct avl_node avl;
+
+	uint8_t from[6];
+	uint8_t to[6]; /* key: from + to */
+
+	uint32_t count; /* beacon request rounds and scans that heard both */
+	int32_t rcpi_delta; /* rcpi(to) - rcpi(from), 1/256 RCPI units, EWMA */
+	bool have_delta;
+	int16_t scan_signal; /* signal of <to> in a scan from <from>, 0 if never scanned */
+	uint64_t seen;
+};
+
+extern struct avl_tree rf_edges;
+
+void usteer_rf_graph_beacon_report(struct sta_info *si, struct beacon_report *br);
+void usteer_rf_graph_scan(struct usteer_local_node *ln);
+uint32_t usteer_rf_graph_score(struct usteer_node *node, struct usteer_node *cand);
+bool usteer_rf_graph_has_neighbors(struct usteer_node *node);
+bool usteer_rf_graph_is_neighbor(struct usteer_node *node, struct usteer_node *cand);
+void usteer_rf_graph_dump(struct blob_buf *buf);
+
+#endif
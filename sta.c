@@ -18,7 +18,12 @@
  */
 
 #include "usteer.h"
+#include "node.h"
 #include "hearing_map.h"
+#include "metrics.h"
+#include "trace.h"
+#include "profile.h"
+#include "mem.h"
 
 static int
 avl_macaddr_cmp(const void *k1, const void *k2, void *ptr)
@@ -28,6 +33,75 @@ avl_macaddr_cmp(const void *k1, const void *k2, void *ptr)
 
 AVL_TREE(stations, avl_macaddr_cmp, false, NULL);
 static struct usteer_timeout_queue tq;
+static struct usteer_timeout_queue steer_tq;
+
+AVL_TREE(probe_stations, avl_macaddr_cmp, false, NULL);
+static LIST_HEAD(probe_sta_lru);
+static struct uloop_timeout probe_sta_timer;
+
+/* least recently seen first */
+static struct list_head sta_lru[__STA_LRU_MAX];
+
+static int64_t usteer_sta_count(unsigned int idx)
+{
+	return stations.count;
+}
+
+static int64_t usteer_probe_sta_count(unsigned int idx)
+{
+	return probe_stations.count;
+}
+
+USTEER_GAUGE_FN(m_stations, "stations", "Stations in the station table",
+		usteer_sta_count);
+USTEER_GAUGE_FN(m_probe_stations, "probe_stations", "Probe-only stations",
+		usteer_probe_sta_count);
+USTEER_COUNTER_VEC(m_evicted, "sta_evicted_total", "Stations evicted from the full table",
+		   "class", sta_lru_classes, STA_LRU_CONNECTED);
+USTEER_COUNTER(m_probe_evicted, "probe_sta_evicted_total",
+	       "Probe-only stations evicted from the full table");
+USTEER_COUNTER(m_probe_suppressed, "probe_suppressed_total",
+	       "Probe requests answered from the previous verdict");
+USTEER_COUNTER(m_rate_limited, "events_rate_limited_total",
+	       "Station events dropped by event_rate_limit");
+USTEER_COUNTER(m_rate_limited_sta, "events_rate_limited_sta_total",
+	       "Station events dropped by event_rate_limit_sta");
+USTEER_COUNTER(m_sta_timeouts, "sta_info_timeouts_total",
+	       "Local station entries deleted after local_sta_timeout");
+
+#define EVENT_LIMIT_SLOTS	256
+
+struct usteer_event_limit {
+	uint8_t addr[6];
+	struct usteer_token_bucket tb;
+};
+
+static struct usteer_event_limit event_limit[EVENT_LIMIT_SLOTS];
+
+const char * const sta_lru_classes[__STA_LRU_MAX] = {
+#define _L(n) [STA_LRU_##n] = #n,
+	__sta_lru_classes
+#undef _L
+};
+
+const char * const sta_caps[__STA_CAP_MAX] = {
+#define _C(n) [STA_CAP_##n] = #n,
+	__sta_caps
+#undef _C
+};
+
+/* upper bounds in msecs, the last bucket catches everything above */
+const uint32_t steer_latency_buckets[STEER_LATENCY_BUCKETS] = {
+	250, 500, 1000, 2000, 5000, 10000, 30000, UINT32_MAX
+};
+
+const char * const steer_reasons[__STEER_REASON_MAX] = {
+#define _R(n) [STEER_REASON_##n] = #n,
+	__steer_reasons
+#undef _R
+};
+
+static void usteer_sta_roam_resolve(struct sta *sta, struct sta_roam_entry *e);
 
 static void
 usteer_sta_del(struct sta *sta)
@@ -35,8 +109,80 @@ usteer_sta_del(struct sta *sta)
 	MSG(DEBUG, "Delete station " MAC_ADDR_FMT "\n",
 	    MAC_ADDR_DATA(sta->addr));
 
+	if (sta->roam_count)
+		usteer_sta_roam_resolve(sta, &sta->roam_history[sta->roam_head]);
 	avl_delete(&stations, &sta->avl);
-	free(sta);
+	list_del(&sta->lru);
+	usteer_free(MEM_STA, sta);
+}
+
+static enum usteer_sta_lru
+usteer_sta_lru_class(struct sta *sta)
+{
+	struct sta_info *si;
+	bool local = false;
+
+	list_for_each_entry(si, &sta->nodes, list) {
+		if (si->connected)
+			return STA_LRU_CONNECTED;
+
+		if (si->node->type == NODE_TYPE_LOCAL)
+			local = true;
+	}
+
+	if (!sta->associated)
+		return STA_LRU_NEW;
+
+	return local ? STA_LRU_IDLE : STA_LRU_REMOTE;
+}
+
+static void
+usteer_sta_touch(struct sta *sta)
+{
+	sta->lru_class = usteer_sta_lru_class(sta);
+	list_move_tail(&sta->lru, &sta_lru[sta->lru_class]);
+}
+
+static void usteer_sta_info_del(struct sta_info *si);
+
+static bool
+usteer_sta_evict(void)
+{
+	struct sta_info *si;
+	struct sta *sta;
+	bool last;
+	int i;
+
+	/* connected stations are never evicted */
+	for (i = 0; i < STA_LRU_CONNECTED; i++) {
+		if (list_empty(&sta_lru[i]))
+			continue;
+
+		sta = list_first_entry(&sta_lru[i], struct sta, lru);
+
+		/* connected without being touched since, file it and retry */
+		if (usteer_sta_lru_class(sta) == STA_LRU_CONNECTED) {
+			usteer_sta_touch(sta);
+			i--;
+			continue;
+		}
+
+		usteer_metric_inc_idx(&m_evicted, i);
+
+		MSG(DEBUG, "Evict station " MAC_ADDR_FMT " (%s)\n",
+		    MAC_ADDR_DATA(sta->addr), sta_lru_classes[i]);
+
+		/* deleting the last sta_info frees the station */
+		do {
+			si = list_first_entry(&sta->nodes, struct sta_info, list);
+			last = si->list.next == &sta->nodes;
+			usteer_sta_info_del(si);
+		} while (!last);
+
+		return true;
+	}
+
+	return false;
 }
 
 static void
@@ -48,10 +194,10 @@ usteer_sta_info_del(struct sta_info *si)
 	    MAC_ADDR_DATA(sta->addr), usteer_node_name(si->node));
 
 	usteer_timeout_cancel(&tq, &si->timeout);
-	usteer_beacon_report_cleanup(si, NULL);
+	usteer_free(MEM_STA_INFO_EXT, si->ext);
 	list_del(&si->list);
 	list_del(&si->node_list);
-	free(si);
+	usteer_free(MEM_STA_INFO, si);
 
 	if (list_empty(&sta->nodes))
 		usteer_sta_del(sta);
@@ -62,8 +208,9 @@ usteer_sta_node_cleanup(struct usteer_node *node)
 {
 	struct sta_info *si, *tmp;
 
-	free(node->rrm_nr);
-	node->rrm_nr = NULL;
+	if (usteer_node_set_blob(&node->rrm_nr, NULL))
+		usteer_local_node_rrm_nr_dirty(NULL);
+	usteer_node_set_blob(&node->script_data, NULL);
 
 	list_for_each_entry_safe(si, tmp, &node->sta_info, node_list)
 		usteer_sta_info_del(si);
@@ -74,12 +221,14 @@ usteer_sta_info_timeout(struct usteer_timeout_queue *q, struct usteer_timeout *t
 {
 	struct sta_info *si = container_of(t, struct sta_info, timeout);
 
-	MSG_T_STA("local_sta_timeout", si->sta->addr,
-		"timeout expired, deleting sta info\n");
+	TRACE_ADDR(LOCAL_STA_TIMEOUT, si->sta->addr);
 
+	usteer_metric_inc(&m_sta_timeouts);
 	usteer_sta_info_del(si);
 }
 
+USTEER_PROFILE_TIMEOUT_QUEUE(STA_TIMEOUT, usteer_sta_info_timeout)
+
 struct sta_info *
 usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create)
 {
@@ -101,14 +250,18 @@ usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create)
 	MSG(DEBUG, "Create station " MAC_ADDR_FMT " entry for node %s\n",
 	    MAC_ADDR_DATA(sta->addr), usteer_node_name(node));
 
-	si = calloc(1, sizeof(*si));
+	si = usteer_calloc(MEM_STA_INFO, sizeof(*si));
 	si->node = node;
 	si->sta = sta;
-	si->beacon_request.band = node->freq;
-	INIT_LIST_HEAD(&si->beacon_reports);
 	list_add(&si->list, &sta->nodes);
 	list_add(&si->node_list, &node->sta_info);
-	si->created = current_time;
+
+	/* remote entries only carry what the policy reads from them */
+	if (node->type == NODE_TYPE_LOCAL) {
+		si->ext = usteer_calloc(MEM_STA_INFO_EXT, sizeof(*si->ext));
+		si->ext->beacon_request.band = node->freq;
+		si->ext->created = current_time;
+	}
 	*create = true;
 
 	return si;
@@ -118,6 +271,8 @@ usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create)
 void
 usteer_sta_info_update_timeout(struct sta_info *si, int timeout)
 {
+	usteer_sta_touch(si->sta);
+
 	if (si->connected == 1)
 		usteer_timeout_cancel(&tq, &si->timeout);
 	else if (timeout > 0)
@@ -138,16 +293,365 @@ usteer_sta_get(const uint8_t *addr, bool create)
 	if (!create)
 		return NULL;
 
+	if (config.max_stations && stations.count >= config.max_stations &&
+	    !usteer_sta_evict())
+		MSG(DEBUG, "All stations connected, exceeding max_stations\n");
+
 	MSG(DEBUG, "Create station entry " MAC_ADDR_FMT "\n", MAC_ADDR_DATA(addr));
-	sta = calloc(1, sizeof(*sta));
+	sta = usteer_calloc(MEM_STA, sizeof(*sta));
 	memcpy(sta->addr, addr, sizeof(sta->addr));
 	sta->avl.key = sta->addr;
 	avl_insert(&stations, &sta->avl);
 	INIT_LIST_HEAD(&sta->nodes);
+	list_add_tail(&sta->lru, &sta_lru[STA_LRU_NEW]);
 
 	return sta;
 }
 
+static bool
+usteer_bssid_is_zero(const uint8_t *bssid)
+{
+	static const uint8_t zero[6];
+
+	return !memcmp(bssid, zero, sizeof(zero));
+}
+
+struct sta_roam_entry *
+usteer_sta_roam_last(struct sta *sta)
+{
+	if (!sta->roam_count)
+		return NULL;
+
+	return &sta->roam_history[sta->roam_head];
+}
+
+static struct sta_roam_entry *
+usteer_sta_roam_next(struct sta *sta)
+{
+	struct sta_roam_entry *e;
+
+	if (sta->roam_count) {
+		usteer_sta_roam_resolve(sta, &sta->roam_history[sta->roam_head]);
+		sta->roam_head = (sta->roam_head + 1) % STA_ROAM_HISTORY;
+	}
+	if (sta->roam_count < STA_ROAM_HISTORY)
+		sta->roam_count++;
+
+	e = &sta->roam_history[sta->roam_head];
+	memset(e, 0, sizeof(*e));
+
+	return e;
+}
+
+static struct usteer_steer_stats *
+usteer_sta_roam_stats(struct sta_roam_entry *e)
+{
+	struct usteer_local_node *ln;
+
+	avl_for_each_element(&local_nodes, ln, node.avl) {
+		if (!memcmp(ln->node.bssid, e->from, sizeof(e->from)))
+			return &ln->steer_stats[e->reason];
+	}
+
+	return NULL;
+}
+
+/*
+ * Account the outcome of a steer by one of our nodes, once the client shows
+ * up again (e->to set) or is considered lost
+ */
+static void
+usteer_sta_roam_resolve(struct sta *sta, struct sta_roam_entry *e)
+{
+	struct usteer_steer_stats *stats;
+	uint32_t latency = current_time - e->time;
+	int i;
+
+	if (!e->pending)
+		return;
+
+	e->pending = 0;
+	usteer_timeout_cancel(&steer_tq, &sta->steer_timeout);
+
+	stats = usteer_sta_roam_stats(e);
+	if (!stats)
+		return;
+
+	if (usteer_bssid_is_zero(e->to)) {
+		stats->lost++;
+		return;
+	}
+
+	if (!memcmp(e->to, e->from, sizeof(e->to)))
+		stats->returned++;
+	else if (!memcmp(e->to, e->target, sizeof(e->to)))
+		stats->target++;
+	else
+		stats->other++;
+
+	for (i = 0; i < STEER_LATENCY_BUCKETS - 1; i++)
+		if (latency <= steer_latency_buckets[i])
+			break;
+	stats->latency[i]++;
+
+	MSG(VERBOSE, "station "MAC_ADDR_FMT" steered (%s) from "MAC_ADDR_FMT
+	    " reassociated to "MAC_ADDR_FMT" after %u ms\n",
+	    MAC_ADDR_DATA(sta->addr), steer_reasons[e->reason],
+	    MAC_ADDR_DATA(e->from), MAC_ADDR_DATA(e->to), latency);
+}
+
+static void
+usteer_sta_steer_timeout(struct usteer_timeout_queue *q, struct usteer_timeout *t)
+{
+	struct sta *sta = container_of(t, struct sta, steer_timeout);
+
+	usteer_sta_roam_resolve(sta, &sta->roam_history[sta->roam_head]);
+}
+
+USTEER_PROFILE_TIMEOUT_QUEUE(STEER_TIMEOUT, usteer_sta_steer_timeout)
+
+static void
+usteer_sta_roam_set_reverted(struct sta_roam_entry *e)
+{
+	struct usteer_steer_stats *stats;
+
+	e->reverted = 1;
+
+	/* a direct return is already accounted as such */
+	if (!e->local || !memcmp(e->to, e->from, sizeof(e->to)))
+		return;
+
+	stats = usteer_sta_roam_stats(e);
+	if (stats)
+		stats->reverted++;
+}
+
+/* keeps the cooldown shift defined, whatever steer_backoff_max is set to */
+#define STEER_BACKOFF_LIMIT	16
+
+static void
+usteer_sta_steer_backoff(struct sta *sta)
+{
+	if (sta->steer_backoff >= config.steer_backoff_max ||
+	    sta->steer_backoff >= STEER_BACKOFF_LIMIT)
+		return;
+
+	sta->steer_backoff++;
+	MSG(VERBOSE, "station "MAC_ADDR_FMT" reverted a steer, backoff=%d\n",
+	    MAC_ADDR_DATA(sta->addr), sta->steer_backoff);
+}
+
+void
+usteer_sta_roam_add(struct sta_info *si, enum usteer_steer_reason reason,
+		    struct usteer_node *target)
+{
+	struct sta *sta = si->sta;
+	struct sta_roam_entry *e = usteer_sta_roam_last(sta);
+	struct usteer_steer_stats *stats;
+
+	/* the previous steer stuck, relax the backoff again */
+	if (e && !e->reverted && sta->steer_backoff &&
+	    current_time - e->time > config.steer_revert_timeout)
+		sta->steer_backoff--;
+
+	e = usteer_sta_roam_next(sta);
+	memcpy(e->from, si->node->bssid, sizeof(e->from));
+	if (target)
+		memcpy(e->target, target->bssid, sizeof(e->target));
+	e->reason = reason;
+	e->time = current_time;
+	e->local = 1;
+	e->pending = 1;
+
+	usteer_timeout_set(&steer_tq, &sta->steer_timeout, config.steer_revert_timeout);
+
+	stats = usteer_sta_roam_stats(e);
+	if (stats)
+		stats->steered++;
+}
+
+void
+usteer_sta_info_assoc(struct sta_info *si)
+{
+	struct sta *sta = si->sta;
+	const uint8_t *bssid = si->node->bssid;
+	struct sta_roam_entry *e;
+	bool reverted = false;
+	int i;
+
+	/* set before the touch, so the station is filed as connected */
+	si->connected = 1;
+	sta->associated = 1;
+	usteer_sta_touch(sta);
+
+	/* a new session, older samples must not count for its trend */
+	if (si->ext)
+		si->ext->signal_history.count = 0;
+
+	e = usteer_sta_roam_last(sta);
+	if (!e || current_time - e->time > config.steer_revert_timeout ||
+	    usteer_bssid_is_zero(bssid))
+		return;
+
+	if (usteer_bssid_is_zero(e->to)) {
+		memcpy(e->to, bssid, sizeof(e->to));
+		usteer_sta_roam_resolve(sta, e);
+	}
+
+	/* back on a node it was steered away from recently */
+	for (i = 0; i < sta->roam_count; i++) {
+		e = &sta->roam_history[(sta->roam_head + STA_ROAM_HISTORY - i) % STA_ROAM_HISTORY];
+		if (current_time - e->time > config.steer_revert_timeout)
+			break;
+
+		if (e->reverted || memcmp(e->from, bssid, sizeof(e->from)) != 0)
+			continue;
+
+		usteer_sta_roam_set_reverted(e);
+		reverted = true;
+	}
+
+	if (reverted)
+		usteer_sta_steer_backoff(sta);
+}
+
+void
+usteer_sta_roam_merge(struct sta *sta, const struct sta_roam_entry *entry)
+{
+	struct sta_roam_entry *e;
+	int i;
+
+	for (i = 0; i < sta->roam_count; i++) {
+		e = &sta->roam_history[i];
+		if (e->reason != entry->reason ||
+		    memcmp(e->from, entry->from, sizeof(e->from)) != 0 ||
+		    e->time + 1000 < entry->time || entry->time + 1000 < e->time)
+			continue;
+
+		if (usteer_bssid_is_zero(e->to) && !usteer_bssid_is_zero(entry->to)) {
+			memcpy(e->to, entry->to, sizeof(e->to));
+			usteer_sta_roam_resolve(sta, e);
+		}
+
+		if (entry->reverted && !e->reverted) {
+			usteer_sta_roam_set_reverted(e);
+			usteer_sta_steer_backoff(sta);
+		}
+		return;
+	}
+
+	/* keep the ring in chronological order */
+	e = usteer_sta_roam_last(sta);
+	if (e && e->time >= entry->time)
+		return;
+
+	e = usteer_sta_roam_next(sta);
+	*e = *entry;
+	if (e->reverted)
+		usteer_sta_steer_backoff(sta);
+}
+
+bool
+usteer_sta_steer_cooldown(struct sta *sta)
+{
+	struct sta_roam_entry *e = usteer_sta_roam_last(sta);
+
+	if (!e)
+		return false;
+
+	return current_time - e->time <
+	       ((uint64_t) config.roam_trigger_interval << sta->steer_backoff);
+}
+
+#define SIGNAL_FILTER_SHIFT	8
+#define SIGNAL_FILTER_RESET	(10 * 1000)
+
+static void
+usteer_sta_info_add_signal(struct sta_info *si, int signal)
+{
+	struct sta_signal_history *sh = &si->ext->signal_history;
+
+	/* do not fit a trend across a gap, it may span two sessions */
+	if (sh->count && current_time - sh->time[sh->head] > SIGNAL_FILTER_RESET)
+		sh->count = 0;
+
+	if (sh->count)
+		sh->head = (sh->head + 1) % STA_SIGNAL_HISTORY;
+	if (sh->count < STA_SIGNAL_HISTORY)
+		sh->count++;
+
+	sh->time[sh->head] = current_time;
+	sh->signal[sh->head] = signal;
+}
+
+/* Kalman process and measurement noise, in (1/256 dB)^2 */
+#define SIGNAL_KALMAN_Q		(1 << (2 * SIGNAL_FILTER_SHIFT))
+#define SIGNAL_KALMAN_R		(9 << (2 * SIGNAL_FILTER_SHIFT))
+
+static int
+usteer_signal_median(struct sta_signal_filter *sf)
+{
+	int a = sf->raw[0], b = sf->raw[1], c = sf->raw[2];
+
+	if (sf->count < 3)
+		return sf->raw[sf->head];
+
+	if ((a <= b && b <= c) || (c <= b && b <= a))
+		return b;
+	if ((b <= a && a <= c) || (c <= a && a <= b))
+		return a;
+	return c;
+}
+
+static int
+usteer_sta_info_filter_signal(struct sta_info *si, int signal)
+{
+	struct sta_signal_filter *sf = &si->ext->signal_filter;
+	int32_t sample, gain, alpha;
+
+	if (config.signal_filter == SIGNAL_FILTER_NONE)
+		return signal;
+
+	if (usteer_sta_info_age(si) > SIGNAL_FILTER_RESET)
+		sf->count = 0;
+
+	if (sf->count)
+		sf->head = (sf->head + 1) % ARRAY_SIZE(sf->raw);
+	else
+		sf->head = 0;
+	if (sf->count < ARRAY_SIZE(sf->raw))
+		sf->count++;
+	sf->raw[sf->head] = signal;
+
+	sample = usteer_signal_median(sf) * (1 << SIGNAL_FILTER_SHIFT);
+	if (sf->count == 1) {
+		sf->estimate = sample;
+		sf->variance = SIGNAL_KALMAN_R;
+		return signal;
+	}
+
+	switch (config.signal_filter) {
+	case SIGNAL_FILTER_KALMAN:
+		sf->variance += SIGNAL_KALMAN_Q;
+		gain = ((int64_t) sf->variance << SIGNAL_FILTER_SHIFT) /
+		       (sf->variance + SIGNAL_KALMAN_R);
+		sf->estimate += ((int64_t) gain * (sample - sf->estimate)) >> SIGNAL_FILTER_SHIFT;
+		sf->variance = ((int64_t) ((1 << SIGNAL_FILTER_SHIFT) - gain) * sf->variance) >>
+			       SIGNAL_FILTER_SHIFT;
+		break;
+	default:
+		/* 0 would freeze the average, more than 100 overshoot */
+		alpha = config.signal_filter_alpha > 100 ? 100 : config.signal_filter_alpha;
+		if (!alpha)
+			alpha = 1;
+		sf->estimate += (sample - sf->estimate) * alpha / 100;
+		break;
+	}
+
+	/* round to the nearest dB */
+	return (sf->estimate + (1 << (SIGNAL_FILTER_SHIFT - 1))) >> SIGNAL_FILTER_SHIFT;
+}
+
 void
 usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 {
@@ -155,26 +659,208 @@ usteer_sta_info_update(struct sta_info *si, int signal, bool avg)
 	if (si->connected == 1 && si->signal != NO_SIGNAL && !avg)
 		signal = NO_SIGNAL;
 
-	if (signal != NO_SIGNAL)
-		si->signal = signal;
+	if (signal != NO_SIGNAL) {
+		si->ext->signal_raw = signal;
+		si->signal = usteer_sta_info_filter_signal(si, signal);
+	}
+
+	if (signal != NO_SIGNAL && avg)
+		usteer_sta_info_add_signal(si, signal);
 
 	si->seen = current_time;
 	usteer_sta_info_update_timeout(si, config.local_sta_timeout);
 }
 
+static void
+usteer_probe_sta_del(struct usteer_probe_sta *ps)
+{
+	avl_delete(&probe_stations, &ps->avl);
+	list_del(&ps->lru);
+	usteer_free(MEM_PROBE_STA, ps);
+}
+
+static void
+usteer_probe_sta_expire(struct uloop_timeout *t)
+{
+	struct usteer_probe_sta *ps, *tmp;
+	uint64_t age;
+
+	usteer_update_time();
+
+	/* the list is sorted by last seen, oldest first */
+	list_for_each_entry_safe(ps, tmp, &probe_sta_lru, lru) {
+		age = current_time - ps->seen;
+		if (age < config.probe_sta_timeout) {
+			uloop_timeout_set(t, config.probe_sta_timeout - age);
+			return;
+		}
+
+		usteer_probe_sta_del(ps);
+	}
+}
+
+USTEER_PROFILE_TIMEOUT(PROBE_STA_EXPIRE, usteer_probe_sta_expire)
+
+static struct usteer_probe_sta *
+usteer_probe_sta_update(const uint8_t *addr, int freq, int signal)
+{
+	struct usteer_probe_sta *ps;
+
+	ps = avl_find_element(&probe_stations, addr, ps, avl);
+	if (ps) {
+		list_del(&ps->lru);
+	} else {
+		if (config.max_probe_stations &&
+		    probe_stations.count >= config.max_probe_stations) {
+			usteer_metric_inc(&m_probe_evicted);
+			usteer_probe_sta_del(list_first_entry(&probe_sta_lru,
+							      struct usteer_probe_sta, lru));
+		}
+
+		ps = usteer_calloc(MEM_PROBE_STA, sizeof(*ps));
+		memcpy(ps->addr, addr, sizeof(ps->addr));
+		ps->avl.key = ps->addr;
+		ps->created = current_time;
+		avl_insert(&probe_stations, &ps->avl);
+	}
+
+	list_add_tail(&ps->lru, &probe_sta_lru);
+	ps->seen = current_time;
+	if (signal != NO_SIGNAL) {
+		if (freq < 4000)
+			ps->signal_2ghz = signal;
+		else
+			ps->signal_5ghz = signal;
+	}
+
+	if (!probe_sta_timer.pending)
+		uloop_timeout_set(&probe_sta_timer, config.probe_sta_timeout);
+
+	return ps;
+}
+
+/* seed the local nodes with what was learned while the station was probing */
+static void
+usteer_probe_sta_promote(struct sta *sta)
+{
+	struct usteer_probe_sta *ps;
+	struct usteer_local_node *ln;
+	struct sta_info *si;
+	bool create;
+	int signal;
+
+	ps = avl_find_element(&probe_stations, sta->addr, ps, avl);
+	if (!ps)
+		return;
+
+	MSG(DEBUG, "Promote probe-only station " MAC_ADDR_FMT "\n",
+	    MAC_ADDR_DATA(sta->addr));
+
+	sta->seen_2ghz = !!ps->signal_2ghz;
+	sta->seen_5ghz = !!ps->signal_5ghz;
+
+	avl_for_each_element(&local_nodes, ln, node.avl) {
+		signal = ln->node.freq < 4000 ? ps->signal_2ghz : ps->signal_5ghz;
+		if (!signal)
+			continue;
+
+		si = usteer_sta_info_get(sta, &ln->node, &create);
+		usteer_sta_info_update(si, signal, false);
+		si->ext->created = ps->created;
+		if (create)
+			usteer_send_sta_update(si);
+	}
+
+	usteer_probe_sta_del(ps);
+}
+
+/* a single flooding address is limited before it can drain the global bucket */
+static bool
+usteer_sta_event_allowed(const uint8_t *addr)
+{
+	static struct usteer_token_bucket global_tb;
+	struct usteer_event_limit *el;
+
+	if (config.event_rate_limit_sta) {
+		/* direct mapped, a colliding address takes the slot over with a full bucket */
+		el = &event_limit[(addr[3] * 31 * 31 + addr[4] * 31 + addr[5]) % EVENT_LIMIT_SLOTS];
+		if (memcmp(el->addr, addr, sizeof(el->addr)) != 0) {
+			memcpy(el->addr, addr, sizeof(el->addr));
+			el->tb.last = current_time;
+			el->tb.tokens = config.event_rate_limit_sta * 1000;
+		}
+
+		if (!usteer_token_bucket_take(&el->tb, config.event_rate_limit_sta,
+					      config.event_rate_limit_sta)) {
+			usteer_metric_inc(&m_rate_limited_sta);
+			return false;
+		}
+	}
+
+	if (config.event_rate_limit &&
+	    !usteer_token_bucket_take(&global_tb, config.event_rate_limit,
+				      config.event_rate_limit)) {
+		usteer_metric_inc(&m_rate_limited);
+		return false;
+	}
+
+	return true;
+}
+
+/* answer of a rate limited event, without creating any state */
+static bool
+usteer_sta_event_cached_ret(struct usteer_node *node, const uint8_t *addr,
+			    enum usteer_event_type type)
+{
+	struct sta_info *si;
+	struct sta *sta;
+
+	sta = usteer_sta_get(addr, false);
+	if (!sta)
+		return true;
+
+	si = usteer_sta_info_get(sta, node, NULL);
+	if (!si || !si->ext || !si->ext->stats[type].requests)
+		return true;
+
+	return si->ext->stats[type].last_ret;
+}
+
 bool
 usteer_handle_sta_event(struct usteer_node *node, const uint8_t *addr,
 		       enum usteer_event_type type, int freq, int signal)
 {
+	struct usteer_probe_sta *ps;
 	struct sta *sta;
 	struct sta_info *si;
 	uint32_t diff;
 	bool ret;
 	bool create;
 
-	sta = usteer_sta_get(addr, true);
-	if (!sta)
-		return -1;
+	if (!usteer_sta_event_allowed(addr))
+		return usteer_sta_event_cached_ret(node, addr, type);
+
+	sta = usteer_sta_get(addr, false);
+	if (!sta && type == EVENT_TYPE_PROBE && config.probe_sta_timeout) {
+		ps = usteer_probe_sta_update(addr, freq, signal);
+		if (current_time - ps->created < config.probe_sta_promote_time) {
+			ret = usteer_check_probe_request(node, ps, signal);
+			if (!ret && ps->blocked < UINT8_MAX)
+				ps->blocked++;
+			else if (ret)
+				ps->blocked = 0;
+
+			return ret;
+		}
+	}
+
+	if (!sta) {
+		sta = usteer_sta_get(addr, true);
+		if (!sta)
+			return -1;
+
+		usteer_probe_sta_promote(sta);
+	}
 
 	if (freq < 4000)
 		sta->seen_2ghz = 1;
@@ -183,23 +869,38 @@ usteer_handle_sta_event(struct usteer_node *node, const uint8_t *addr,
 
 	si = usteer_sta_info_get(sta, node, &create);
 	usteer_sta_info_update(si, signal, false);
-	si->roam_scan_done = current_time;
-	si->stats[type].requests++;
+	si->ext->roam_scan_done = current_time;
+
+	/*
+	 * hostapd notifies every probe request of a burst, only evaluate the
+	 * policy once per probe_dedup_window and reuse the verdict otherwise
+	 */
+	if (type == EVENT_TYPE_PROBE && config.probe_dedup_window &&
+	    si->ext->stats[type].requests &&
+	    (uint32_t) current_time - si->ext->stats[type].last_time < config.probe_dedup_window) {
+		si->ext->stats[type].requests++;
+		usteer_metric_inc(&m_probe_suppressed);
+		return si->ext->stats[type].last_ret;
+	}
 
-	diff = si->stats[type].blocked_last_time - current_time;
+	si->ext->stats[type].requests++;
+
+	diff = si->ext->stats[type].blocked_last_time - current_time;
 	if (diff > config.sta_block_timeout) {
-		si->stats[type].blocked_cur = 0;
-		MSG_T_STA("sta_block_timeout", addr, "timeout expired\n");
+		si->ext->stats[type].blocked_cur = 0;
+		TRACE_ADDR(STA_BLOCK_TIMEOUT, addr);
 	}
 
 	ret = usteer_check_request(si, type);
 	if (!ret) {
-		si->stats[type].blocked_cur++;
-		si->stats[type].blocked_total++;
-		si->stats[type].blocked_last_time = current_time;
+		si->ext->stats[type].blocked_cur++;
+		si->ext->stats[type].blocked_total++;
+		si->ext->stats[type].blocked_last_time = current_time;
 	} else {
-		si->stats[type].blocked_cur = 0;
+		si->ext->stats[type].blocked_cur = 0;
 	}
+	si->ext->stats[type].last_time = current_time;
+	si->ext->stats[type].last_ret = ret;
 
 	if (create)
 		usteer_send_sta_update(si);
@@ -209,6 +910,14 @@ usteer_handle_sta_event(struct usteer_node *node, const uint8_t *addr,
 
 static void __usteer_init usteer_sta_init(void)
 {
+	int i;
+
 	usteer_timeout_init(&tq);
-	tq.cb = usteer_sta_info_timeout;
+	tq.cb = usteer_sta_info_timeout_profiled;
+	usteer_timeout_init(&steer_tq);
+	steer_tq.cb = usteer_sta_steer_timeout_profiled;
+	probe_sta_timer.cb = usteer_probe_sta_expire_profiled;
+
+	for (i = 0; i < __STA_LRU_MAX; i++)
+		INIT_LIST_HEAD(&sta_lru[i]);
 }
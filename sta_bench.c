@@ -0,0 +1,229 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Walks the station lists the way the candidate loop of the policy does
+ * (node, seen and signal of every entry of sta->nodes), once with the
+ * sta_info layout before the hot/cold split and once with the current one.
+ *
+ * Entries are allocated interleaved, node by node, like a running daemon
+ * creates them as stations show up on the nodes. Only the entries of the
+ * first node are local and carry an extension.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "usteer.h"
+
+/* struct sta_info before the split, only walked by the legacy variant */
+struct sta_info_legacy {
+	struct list_head list;
+	struct list_head node_list;
+	struct list_head beacon_reports;
+
+	struct usteer_node *node;
+	struct sta *sta;
+
+	struct usteer_timeout timeout;
+
+	struct sta_info_stats stats[__EVENT_TYPE_MAX];
+	uint64_t created;
+	uint64_t seen;
+	int signal;
+	int signal_raw;
+	struct sta_signal_filter signal_filter;
+	struct sta_signal_history signal_history;
+
+	enum roam_trigger_state roam_state;
+	uint8_t roam_tries;
+	uint64_t roam_event;
+	uint64_t roam_kick;
+	uint64_t roam_scan_done;
+
+	int kick_count;
+	struct sta_active_bytes active_bytes;
+	struct sta_airtime airtime;
+	struct beacon_request beacon_request;
+
+	uint8_t scan_band : 1;
+	uint8_t connected : 2;
+};
+
+#define BENCH_MAX_NODES	64
+#define BENCH_MAX_AGE	30000
+
+uint64_t current_time;
+
+static struct usteer_node nodes[BENCH_MAX_NODES];
+static unsigned int n_sta = 20000, n_nodes = 8, rounds = 50;
+
+/* keeps the results alive so the compiler can't drop the work */
+static volatile uint64_t sink;
+
+static uint64_t bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *bench_calloc(size_t size)
+{
+	void *ptr = calloc(1, size);
+
+	if (!ptr) {
+		perror("calloc");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static struct sta *bench_sta_alloc(void)
+{
+	struct sta *stas = bench_calloc(n_sta * sizeof(*stas));
+	unsigned int i;
+
+	for (i = 0; i < n_sta; i++)
+		INIT_LIST_HEAD(&stas[i].nodes);
+
+	return stas;
+}
+
+static void bench_report(const char *name, uint64_t elapsed)
+{
+	double entries = (double) rounds * n_sta * n_nodes;
+
+	printf("%-8s %.0f entries in %.3f s: %.1f ns/entry\n",
+	       name, entries, elapsed / 1e9, elapsed / entries);
+}
+
+static void bench_legacy(void)
+{
+	struct sta_info_legacy *si;
+	struct sta *stas = bench_sta_alloc();
+	uint64_t start, sum = 0;
+	unsigned int i, j, r;
+
+	for (j = 0; j < n_nodes; j++) {
+		for (i = 0; i < n_sta; i++) {
+			si = bench_calloc(sizeof(*si));
+			si->node = &nodes[j];
+			si->sta = &stas[i];
+			si->signal = -(rand() % 60);
+			si->seen = current_time - rand() % (2 * BENCH_MAX_AGE);
+			list_add(&si->list, &stas[i].nodes);
+		}
+	}
+
+	start = bench_time();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n_sta; i++) {
+			list_for_each_entry(si, &stas[i].nodes, list) {
+				if (current_time - si->seen < BENCH_MAX_AGE ||
+				    si->signal > -40)
+					sum += si->node == &nodes[0];
+			}
+		}
+	}
+	bench_report("legacy", bench_time() - start);
+	sink += sum;
+}
+
+static void bench_current(void)
+{
+	struct sta_info *si;
+	struct sta *stas = bench_sta_alloc();
+	uint64_t start, sum = 0;
+	unsigned int i, j, r;
+
+	for (j = 0; j < n_nodes; j++) {
+		for (i = 0; i < n_sta; i++) {
+			si = bench_calloc(sizeof(*si));
+			if (!j)
+				si->ext = bench_calloc(sizeof(*si->ext));
+			si->node = &nodes[j];
+			si->sta = &stas[i];
+			si->signal = -(rand() % 60);
+			si->seen = current_time - rand() % (2 * BENCH_MAX_AGE);
+			list_add(&si->list, &stas[i].nodes);
+		}
+	}
+
+	start = bench_time();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n_sta; i++) {
+			list_for_each_entry(si, &stas[i].nodes, list) {
+				if (usteer_sta_info_age(si) < BENCH_MAX_AGE ||
+				    si->signal > -40)
+					sum += si->node == &nodes[0];
+			}
+		}
+	}
+	bench_report("current", bench_time() - start);
+	sink += sum;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		" -s <count>:   Number of stations (default: 20000)\n"
+		" -n <count>:   Number of node entries per station (default: 8, max: %d)\n"
+		" -r <rounds>:  Number of walks over all stations (default: 50)\n"
+		"\n", prog, BENCH_MAX_NODES);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "s:n:r:")) != -1) {
+		switch (ch) {
+		case 's':
+			n_sta = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n_nodes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (!n_sta || !n_nodes || n_nodes > BENCH_MAX_NODES || !rounds)
+		return usage(argv[0]);
+
+	printf("sizeof: legacy sta_info %zu, sta_info %zu (hot part %zu), sta_info_ext %zu\n",
+	       sizeof(struct sta_info_legacy), sizeof(struct sta_info),
+	       offsetof(struct sta_info, timeout), sizeof(struct sta_info_ext));
+
+	current_time = 1000000;
+	srand(1);
+	bench_legacy();
+	srand(1);
+	bench_current();
+
+	return 0;
+}
@@ -22,6 +22,7 @@
 #include <libubox/utils.h>
 
 #include "timeout.h"
+#include "probe.h"
 
 static int usteer_timeout_cmp(const void *k1, const void *k2, void *ptr)
 {
@@ -90,6 +91,7 @@ static void usteer_timeout_cb(struct uloop_timeout *timeout)
 			if (usteer_timeout_delta(t, time) > 0)
 				break;
 
+			USTEER_PROBE(timeout, q, t, -usteer_timeout_delta(t, time));
 			usteer_timeout_cancel(q, t);
 			if (q->cb)
 				q->cb(q, t);
@@ -39,6 +39,13 @@ usteer_timeout_isset(struct usteer_timeout *t)
 	return t->node.list.prev != NULL;
 }
 
+/* CLOCK_MONOTONIC in msecs, truncated to 32 bit */
+static inline uint32_t
+usteer_timeout_expiry(struct usteer_timeout *t)
+{
+	return (uint32_t) (intptr_t) t->node.key;
+}
+
 void usteer_timeout_init(struct usteer_timeout_queue *q);
 void usteer_timeout_set(struct usteer_timeout_queue *q, struct usteer_timeout *t,
 		       int msecs);
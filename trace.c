@@ -0,0 +1,89 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "usteer.h"
+#include "trace.h"
+
+struct usteer_trace_entry usteer_trace_ring[TRACE_RING_SIZE];
+uint32_t usteer_trace_head;
+
+static const struct usteer_trace_desc trace_desc[__TRACE_MAX] = {
+#define _T __TRACE_DESC
+	__trace_events
+#undef _T
+};
+
+/*
+ * Entries from sequence number <since> on that were not overwritten yet.
+ * Slots that were never written are told apart by their sequence number.
+ */
+void usteer_trace_dump(struct blob_buf *buf, uint32_t since, bool raw)
+{
+	static const char hex[] = "0123456789abcdef";
+	uint8_t data[TRACE_ENTRY_LEN];
+	struct usteer_trace_entry *e;
+	uint32_t seq, start, dropped = 0;
+	char text[256], *str;
+	void *c, *t;
+	int i;
+
+	/* e.g. a sequence number from before a restart */
+	if ((int32_t) (usteer_trace_head - since) < 0)
+		since = usteer_trace_head;
+
+	start = usteer_trace_head - TRACE_RING_SIZE;
+	if (usteer_trace_head - since <= TRACE_RING_SIZE)
+		start = since;
+	else
+		dropped = usteer_trace_head - since - TRACE_RING_SIZE;
+
+	blobmsg_add_u32(buf, "head", usteer_trace_head);
+	blobmsg_add_u32(buf, "dropped", dropped);
+
+	if (raw) {
+		str = blobmsg_alloc_string_buffer(buf, "data",
+			(usteer_trace_head - start) * TRACE_ENTRY_LEN * 2 + 1);
+		for (seq = start; seq != usteer_trace_head; seq++) {
+			e = &usteer_trace_ring[seq & (TRACE_RING_SIZE - 1)];
+			if (e->seq != seq)
+				continue;
+
+			usteer_trace_entry_pack(data, e);
+			for (i = 0; i < TRACE_ENTRY_LEN; i++) {
+				*(str++) = hex[data[i] >> 4];
+				*(str++) = hex[data[i] & 0xf];
+			}
+		}
+		*str = 0;
+		blobmsg_add_string_buffer(buf);
+		return;
+	}
+
+	c = blobmsg_open_array(buf, "events");
+	for (seq = start; seq != usteer_trace_head; seq++) {
+		e = &usteer_trace_ring[seq & (TRACE_RING_SIZE - 1)];
+		if (e->seq != seq || e->id >= __TRACE_MAX)
+			continue;
+
+		usteer_trace_format(text, sizeof(text), &trace_desc[e->id], e);
+		t = blobmsg_open_table(buf, NULL);
+		blobmsg_add_u32(buf, "seq", e->seq);
+		blobmsg_add_u32(buf, "time", e->time);
+		blobmsg_add_string(buf, "event", trace_desc[e->id].name);
+		blobmsg_add_string(buf, "text", text);
+		blobmsg_close_table(buf, t);
+	}
+	blobmsg_close_array(buf, c);
+}
@@ -0,0 +1,188 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __APMGR_TRACE_H
+#define __APMGR_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* must be a power of two */
+#define TRACE_RING_SIZE		2048
+
+/* size of an entry as exported by the trace ubus method (big endian) */
+#define TRACE_ENTRY_LEN		32
+
+enum usteer_trace_addr {
+	TRACE_ADDR_NONE,
+	TRACE_ADDR_STA,
+	TRACE_ADDR_NODE,
+};
+
+/*
+ * _T(id, address type, option, format): the format takes up to four
+ * integer arguments, event types, states and reasons are traced by value.
+ */
+#define __trace_events \
+	_T(STA_EVENT, STA, "sta_event", "event type %d (freq=%d) (signal=%d) handled: %d") \
+	_T(ROAM_STATE, STA, "roam_state", "roam trigger state %d (tries=%d) (signal=%d)") \
+	_T(LOCAL_STA_UPDATE, NONE, "local_sta_update", "timeout (%u) expired") \
+	_T(ASSOC_THRESHOLD, STA, "band_steering_threshold,load_balancing_threshold", \
+	   "exceeded (bs=%u, lb=%u)") \
+	_T(SIGNAL_DIFF, STA, "signal_diff_threshold", "exceeded (config=%i) (real=%i)") \
+	_T(RCPI_DIFF, STA, "rcpi_diff_threshold", "exceeded (config=%i) (real=%i)") \
+	_T(SEEN_POLICY_TIMEOUT, STA, "seen_policy_timeout", "timeout exceeded (%u)") \
+	_T(MAX_RETRY_BAND, STA, "max_retry_band", "max retry (%u) exceeded") \
+	_T(MIN_CONNECT_SNR, STA, "min_connect_snr", "snr to low (config=%i) (real=%i)") \
+	_T(INITIAL_CONNECT_DELAY, STA, "initial_connect_delay", "is below delay (%u)") \
+	_T(LOAD_KICK_ACTIVE, STA, "load_kick_active", \
+	   "client is still active (config=%u) (real=%u, burst=%u)") \
+	_T(LOAD_KICK_INACTIVE, STA, "load_kick_active", \
+	   "client is inactive (config=%u) (real=%u, burst=%u)") \
+	_T(LOAD_KICK_THRESHOLD, NODE, "load_kick_threshold", \
+	   "is below load for this node (config=%i) (real=%i)") \
+	_T(LOAD_KICK_DELAY, NODE, "load_kick_delay", "delay kicking (config=%i)") \
+	_T(LOAD_KICK_MIN_CLIENTS, NODE, "load_kick_min_clients", \
+	   "min limit reached, stop kicking clients on this node (n_assoc=%i) (config=%i)") \
+	_T(REMOTE_UPDATE, NONE, "remote_update_interval", "start remote update (interval=%u)") \
+	_T(VENDOR_UPDATE, NONE, "vendor_update_interval", "start vendor update (interval=%u)") \
+	_T(LOCAL_STA_TIMEOUT, STA, "local_sta_timeout", "timeout expired, deleting sta info") \
+	_T(STA_BLOCK_TIMEOUT, STA, "sta_block_timeout", "timeout expired") \
+	_T(BTM_REQUEST, STA, "roam_kick_delay", \
+	   "request BSS transition to freq %d (%d candidates, token %u)") \
+	_T(CLIENT_SCAN, STA, "load_kick_reason_code", \
+	   "tell hostapd to issue a client beacon request (5ghz: %d)") \
+	_T(KICK, STA, "load_kick_reason_code", \
+	   "tell hostapd to kick client with reason code %u (steer reason %u)")
+
+enum usteer_trace_id {
+#define _T(_id, ...) TRACE_##_id,
+	__trace_events
+#undef _T
+	__TRACE_MAX
+};
+
+struct usteer_trace_desc {
+	const char *name;
+	const char *option;
+	const char *format;
+	enum usteer_trace_addr addr;
+};
+
+/* use as _T in a struct usteer_trace_desc [__TRACE_MAX] initializer */
+#define __TRACE_DESC(_id, _addr, _option, _format) \
+	[TRACE_##_id] = { #_id, _option, _format, TRACE_ADDR_##_addr },
+
+struct usteer_trace_entry {
+	uint32_t seq;
+	uint32_t time; /* current_time, truncated */
+	uint16_t id;
+	uint8_t addr[6];
+	int32_t args[4];
+};
+
+extern struct usteer_trace_entry usteer_trace_ring[TRACE_RING_SIZE];
+extern uint32_t usteer_trace_head;
+extern uint64_t current_time;
+
+/*
+ * There is only one writer, the uloop thread, and readers run on the same
+ * thread, so recording an event needs no locking or atomics. Readers detect
+ * overwritten entries by their sequence number.
+ */
+static inline void
+usteer_trace(enum usteer_trace_id id, const uint8_t *addr,
+	     int32_t a0, int32_t a1, int32_t a2, int32_t a3)
+{
+	struct usteer_trace_entry *e;
+
+	e = &usteer_trace_ring[usteer_trace_head & (TRACE_RING_SIZE - 1)];
+	e->seq = usteer_trace_head++;
+	e->time = current_time;
+	e->id = id;
+	if (addr)
+		memcpy(e->addr, addr, sizeof(e->addr));
+	else
+		memset(e->addr, 0, sizeof(e->addr));
+	e->args[0] = a0;
+	e->args[1] = a1;
+	e->args[2] = a2;
+	e->args[3] = a3;
+}
+
+#define __TRACE_ARGS(_x, _a0, _a1, _a2, _a3, ...) _a0, _a1, _a2, _a3
+
+#define TRACE(_id, ...) \
+	usteer_trace(TRACE_##_id, NULL, __TRACE_ARGS(0, ##__VA_ARGS__, 0, 0, 0, 0))
+
+#define TRACE_ADDR(_id, _addr, ...) \
+	usteer_trace(TRACE_##_id, _addr, __TRACE_ARGS(0, ##__VA_ARGS__, 0, 0, 0, 0))
+
+static inline void
+usteer_trace_entry_pack(uint8_t *buf, const struct usteer_trace_entry *e)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		buf[i] = e->seq >> (24 - 8 * i);
+		buf[4 + i] = e->time >> (24 - 8 * i);
+	}
+	buf[8] = e->id >> 8;
+	buf[9] = e->id;
+	memcpy(buf + 10, e->addr, sizeof(e->addr));
+	for (i = 0; i < 16; i++)
+		buf[16 + i] = (uint32_t) e->args[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static inline void
+usteer_trace_entry_unpack(struct usteer_trace_entry *e, const uint8_t *buf)
+{
+	int i;
+
+	memset(e, 0, sizeof(*e));
+	for (i = 0; i < 4; i++) {
+		e->seq = (e->seq << 8) | buf[i];
+		e->time = (e->time << 8) | buf[4 + i];
+	}
+	e->id = (buf[8] << 8) | buf[9];
+	memcpy(e->addr, buf + 10, sizeof(e->addr));
+	for (i = 0; i < 16; i++)
+		e->args[i / 4] = ((uint32_t) e->args[i / 4] << 8) | buf[16 + i];
+}
+
+/* "TESTCASE=<option>[,STA=<addr>]: <message>", like the debug_level 5 messages used to */
+static inline int
+usteer_trace_format(char *buf, size_t len, const struct usteer_trace_desc *desc,
+		    const struct usteer_trace_entry *e)
+{
+	const uint8_t *a = e->addr;
+	int ofs;
+
+	ofs = snprintf(buf, len, "TESTCASE=%s", desc->option);
+	if (ofs < len && desc->addr != TRACE_ADDR_NONE)
+		ofs += snprintf(buf + ofs, len - ofs, ",%s=%02x:%02x:%02x:%02x:%02x:%02x",
+				desc->addr == TRACE_ADDR_STA ? "STA" : "NODE",
+				a[0], a[1], a[2], a[3], a[4], a[5]);
+	if (ofs < len)
+		ofs += snprintf(buf + ofs, len - ofs, ": ");
+	if (ofs < len)
+		ofs += snprintf(buf + ofs, len - ofs, desc->format,
+				e->args[0], e->args[1], e->args[2], e->args[3]);
+
+	return ofs;
+}
+
+#endif
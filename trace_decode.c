@@ -0,0 +1,94 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Decodes the raw trace ring of usteerd, e.g.
+ *   ubus call usteer trace '{"raw":true}' | jsonfilter -e @.data | usteer-trace
+ * Any character that is not a hex digit is skipped, so the data may also be
+ * split over several lines.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "trace.h"
+
+static const struct usteer_trace_desc trace_desc[__TRACE_MAX] = {
+#define _T __TRACE_DESC
+	__trace_events
+#undef _T
+};
+
+static int hex_val(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	return tolower(c) - 'a' + 10;
+}
+
+static void print_entry(const uint8_t *data)
+{
+	struct usteer_trace_entry e;
+	char text[256];
+
+	usteer_trace_entry_unpack(&e, data);
+	if (e.id >= __TRACE_MAX) {
+		printf("%u %u.%03u unknown event %u\n", e.seq,
+		       e.time / 1000, e.time % 1000, e.id);
+		return;
+	}
+
+	usteer_trace_format(text, sizeof(text), &trace_desc[e.id], &e);
+	printf("%u %u.%03u %s %s\n", e.seq, e.time / 1000, e.time % 1000,
+	       trace_desc[e.id].name, text);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t data[TRACE_ENTRY_LEN];
+	bool high = true;
+	int len = 0;
+	int c;
+
+	if (argc > 1) {
+		fprintf(stderr, "Usage: %s < <hex trace data>\n", argv[0]);
+		return 1;
+	}
+
+	while ((c = getchar()) != EOF) {
+		if (!isxdigit(c))
+			continue;
+
+		if (high) {
+			data[len] = hex_val(c) << 4;
+		} else {
+			data[len] |= hex_val(c);
+			if (++len == TRACE_ENTRY_LEN) {
+				print_entry(data);
+				len = 0;
+			}
+		}
+		high = !high;
+	}
+
+	if (len || !high) {
+		fprintf(stderr, "Truncated trace entry at the end of the input\n");
+		return 1;
+	}
+
+	return 0;
+}
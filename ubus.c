@@ -28,8 +28,19 @@
 #include "usteer.h"
 #include "node.h"
 #include "hearing_map.h"
+#include "rf_graph.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probe.h"
+#include "profile.h"
+#include "mem.h"
 
-static struct blob_buf b;
+USTEER_BLOB_BUF(b, "ubus")
+
+USTEER_COUNTER_VEC(m_kicks, "kicks_total", "Clients kicked off a local node",
+		   "reason", steer_reasons, __STEER_REASON_MAX);
+USTEER_COUNTER(m_btm_requests, "btm_requests_total",
+	       "BSS transition requests sent to clients");
 
 static int
 usteer_ubus_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
@@ -83,6 +94,7 @@ usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 	struct blob_attr *mac_str;
 	uint8_t *mac;
 	void *_n, *_cur_n, *_s;
+	int slope, projected;
 	int i;
 
 	blobmsg_parse(client_arg, 1, &mac_str, blob_data(msg), blob_len(msg));
@@ -105,18 +117,55 @@ usteer_ubus_get_client_info(struct ubus_context *ctx, struct ubus_object *obj,
 		_cur_n = blobmsg_open_table(&b, usteer_node_name(si->node));
 		blobmsg_add_u8(&b, "connected", si->connected);
 		blobmsg_add_u32(&b, "signal", si->signal);
-		_s = blobmsg_open_table(&b, "stats");
-		for (i = 0; i < __EVENT_TYPE_MAX; i++)
-			usteer_ubus_add_stats(&si->stats[EVENT_TYPE_PROBE], event_types[i]);
-		blobmsg_close_table(&b, _s);
+		if (si->ext) {
+			blobmsg_add_u32(&b, "signal_raw", si->ext->signal_raw);
+			_s = blobmsg_open_table(&b, "stats");
+			for (i = 0; i < __EVENT_TYPE_MAX; i++)
+				usteer_ubus_add_stats(&si->ext->stats[EVENT_TYPE_PROBE], event_types[i]);
+			blobmsg_close_table(&b, _s);
+		}
 		if (si->node->type == NODE_TYPE_LOCAL && si->connected) {
 			blobmsg_add_u64(&b, "average_data_rate", usteer_get_client_active_bits(si));
+			blobmsg_add_u64(&b, "burst_data_rate", usteer_get_client_burst_bits(si));
+			blobmsg_add_u64(&b, "peak_data_rate", si->ext->active_bytes.peak);
+			blobmsg_add_u32(&b, "tx_bitrate", si->ext->airtime.tx_bitrate);
+			blobmsg_add_u32(&b, "rx_bitrate", si->ext->airtime.rx_bitrate);
+			blobmsg_add_u32(&b, "expected_throughput", si->ext->airtime.expected_throughput);
+			blobmsg_add_u32(&b, "airtime", si->ext->airtime.share);
+			if (usteer_sta_info_signal_trend(si, config.roam_predict_time,
+							 &slope, &projected)) {
+				blobmsg_add_u32(&b, "signal_trend", slope);
+				blobmsg_add_u32(&b, "signal_projected", projected);
+			}
 			usteer_ubus_hearing_map(&b, si);
 		}
 		blobmsg_close_table(&b, _cur_n);
 	}
 	blobmsg_close_table(&b, _n);
 
+	_n = blobmsg_open_table(&b, "capabilities");
+	for (i = 0; i < __STA_CAP_MAX; i++) {
+		if (sta->caps_known & (1 << i))
+			blobmsg_add_u8(&b, sta_caps[i], !!(sta->caps & (1 << i)));
+	}
+	blobmsg_close_table(&b, _n);
+
+	blobmsg_add_u32(&b, "steer_backoff", sta->steer_backoff);
+	_n = blobmsg_open_array(&b, "roam_history");
+	for (i = 0; i < sta->roam_count; i++) {
+		struct sta_roam_entry *e;
+
+		e = &sta->roam_history[(sta->roam_head + STA_ROAM_HISTORY - i) % STA_ROAM_HISTORY];
+		_s = blobmsg_open_table(&b, NULL);
+		blobmsg_printf(&b, "from", MAC_ADDR_FMT, MAC_ADDR_DATA(e->from));
+		blobmsg_printf(&b, "to", MAC_ADDR_FMT, MAC_ADDR_DATA(e->to));
+		blobmsg_add_string(&b, "reason", steer_reasons[e->reason]);
+		blobmsg_add_u8(&b, "reverted", e->reverted);
+		blobmsg_add_u32(&b, "age", current_time - e->time);
+		blobmsg_close_table(&b, _s);
+	}
+	blobmsg_close_array(&b, _n);
+
 	ubus_send_reply(ctx, req, b.head);
 
 	return 0;
@@ -150,6 +199,13 @@ struct cfg_item {
 	_cfg(U32, sta_block_timeout), \
 	_cfg(U32, local_sta_timeout), \
 	_cfg(U32, local_sta_update), \
+	_cfg(U32, probe_sta_timeout), \
+	_cfg(U32, probe_sta_promote_time), \
+	_cfg(U32, probe_dedup_window), \
+	_cfg(U32, event_rate_limit), \
+	_cfg(U32, event_rate_limit_sta), \
+	_cfg(U32, max_stations), \
+	_cfg(U32, max_probe_stations), \
 	_cfg(U32, max_retry_band), \
 	_cfg(U32, seen_policy_timeout), \
 	_cfg(U32, load_balancing_threshold), \
@@ -162,6 +218,11 @@ struct cfg_item {
 	_cfg(U32, roam_scan_interval), \
 	_cfg(I32, roam_trigger_snr), \
 	_cfg(U32, roam_trigger_interval), \
+	_cfg(U32, roam_predict_time), \
+	_cfg(U32, steer_backoff_max), \
+	_cfg(U32, steer_revert_timeout), \
+	_cfg(U32, signal_filter), \
+	_cfg(U32, signal_filter_alpha), \
 	_cfg(U32, roam_kick_delay), \
 	_cfg(U32, signal_diff_threshold), \
 	_cfg(U32, initial_connect_delay), \
@@ -172,12 +233,23 @@ struct cfg_item {
 	_cfg(U32, load_kick_reason_code), \
 	_cfg(U32, kick_client_active_sec), \
 	_cfg(U32, kick_client_active_bits), \
+	_cfg(U32, airtime_kick_threshold), \
+	_cfg(U32, airtime_kick_delay), \
+	_cfg(U32, airtime_kick_throughput), \
 	_cfg(U32, beacon_report_invalide_timeout), \
 	_cfg(U32, beacon_request_frequency), \
 	_cfg(U32, beacon_request_signal_modifier), \
+	_cfg(U32, beacon_request_rate), \
+	_cfg(U32, beacon_request_burst), \
+	_cfg(U32, hearing_map_share_interval), \
+	_cfg(U32, rf_scan_interval), \
+	_cfg(U32, rf_neighbor_min_count), \
+	_cfg(U32, rrm_nr_max_entries), \
+	_cfg(U32, profile_stall_threshold), \
 	_cfg(ARRAY_CB, interfaces), \
 	_cfg(ARRAY_CB, ssid), \
-	_cfg(STRING_CB, node_up_script)
+	_cfg(STRING_CB, node_up_script), \
+	_cfg(STRING_CB, prometheus_listen)
 
 enum cfg_items {
 #define _cfg(_type, _name) CFG_##_name
@@ -269,6 +341,9 @@ usteer_ubus_set_config(struct ubus_context *ctx, struct ubus_object *obj,
 		}
 	}
 
+	/* rrm_nr_max_entries and rf_neighbor_min_count shape the lists */
+	usteer_local_node_rrm_nr_dirty(NULL);
+
 	return 0;
 }
 
@@ -337,6 +412,48 @@ bool usteer_is_valid_ssid(const char *ssid)
 	return valid;
 }
 
+static void
+usteer_dump_steer_stats(struct usteer_local_node *ln)
+{
+	struct usteer_steer_stats *stats;
+	uint32_t resolved;
+	char name[16];
+	void *c, *r, *l;
+	int i, j;
+
+	c = blobmsg_open_table(&b, "steering");
+	for (i = 0; i < __STEER_REASON_MAX; i++) {
+		stats = &ln->steer_stats[i];
+		if (!stats->steered)
+			continue;
+
+		r = blobmsg_open_table(&b, steer_reasons[i]);
+		blobmsg_add_u32(&b, "steered", stats->steered);
+		blobmsg_add_u32(&b, "target", stats->target);
+		blobmsg_add_u32(&b, "other", stats->other);
+		blobmsg_add_u32(&b, "returned", stats->returned);
+		blobmsg_add_u32(&b, "reverted", stats->reverted);
+		blobmsg_add_u32(&b, "lost", stats->lost);
+
+		/* percentage of resolved steers that reached the intended node */
+		resolved = stats->target + stats->other + stats->returned + stats->lost;
+		if (resolved)
+			blobmsg_add_u32(&b, "success", stats->target * 100 / resolved);
+
+		l = blobmsg_open_table(&b, "latency");
+		for (j = 0; j < STEER_LATENCY_BUCKETS; j++) {
+			if (steer_latency_buckets[j] == UINT32_MAX)
+				strcpy(name, "inf");
+			else
+				snprintf(name, sizeof(name), "%u", steer_latency_buckets[j]);
+			blobmsg_add_u32(&b, name, stats->latency[j]);
+		}
+		blobmsg_close_table(&b, l);
+		blobmsg_close_table(&b, r);
+	}
+	blobmsg_close_table(&b, c);
+}
+
 static void
 usteer_dump_node_info(struct usteer_node *node)
 {
@@ -347,11 +464,39 @@ usteer_dump_node_info(struct usteer_node *node)
 	blobmsg_add_u32(&b, "n_assoc", node->n_assoc);
 	blobmsg_add_u32(&b, "noise", node->noise);
 	blobmsg_add_u32(&b, "load", node->load);
+	blobmsg_add_u32(&b, "airtime", node->airtime);
 	blobmsg_add_u32(&b, "max_assoc", node->max_assoc);
 	if (node->rrm_nr)
 		blobmsg_add_field(&b, BLOBMSG_TYPE_ARRAY, "rrm_nr",
 				  blobmsg_data(node->rrm_nr),
 				  blobmsg_data_len(node->rrm_nr));
+	if (node->type == NODE_TYPE_LOCAL) {
+		struct usteer_local_node *ln;
+		void *r;
+
+		ln = container_of(node, struct usteer_local_node, node);
+		usteer_dump_steer_stats(ln);
+
+		r = blobmsg_open_table(&b, "bss_transition");
+		blobmsg_add_u32(&b, "sent", ln->btm.sent);
+		blobmsg_add_u32(&b, "accepted", ln->btm.accepted);
+		blobmsg_add_u32(&b, "rejected", ln->btm.rejected);
+		blobmsg_add_u32(&b, "timeout", ln->btm.timeout);
+		blobmsg_close_table(&b, r);
+
+		r = blobmsg_open_table(&b, "neighbor_report");
+		blobmsg_add_u32(&b, "entries", ln->rrm_nr.entries);
+		blobmsg_add_u32(&b, "pushed", ln->rrm_nr.pushed);
+		blobmsg_add_u32(&b, "unchanged", ln->rrm_nr.unchanged);
+		blobmsg_close_table(&b, r);
+
+		r = blobmsg_open_table(&b, "beacon_requests");
+		blobmsg_add_u32(&b, "queued", ln->beacon_req.queued);
+		blobmsg_add_u32(&b, "sent", ln->beacon_req.sent);
+		blobmsg_add_u32(&b, "deferred", ln->beacon_req.deferred);
+		blobmsg_add_u32(&b, "downgraded", ln->beacon_req.downgraded);
+		blobmsg_close_table(&b, r);
+	}
 	blobmsg_close_table(&b, c);
 }
 
@@ -389,8 +534,94 @@ usteer_ubus_remote_info(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
+static int
+usteer_ubus_get_metrics(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	blob_buf_init(&b, 0);
+	usteer_metrics_dump(&b);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+static int
+usteer_ubus_get_profile(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	blob_buf_init(&b, 0);
+	usteer_profile_dump(&b);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+static int
+usteer_ubus_get_memory(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	blob_buf_init(&b, 0);
+	usteer_mem_dump(&b);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+static int
+usteer_ubus_get_topology(struct ubus_context *ctx, struct ubus_object *obj,
+			 struct ubus_request_data *req, const char *method,
+			 struct blob_attr *msg)
+{
+	blob_buf_init(&b, 0);
+	usteer_rf_graph_dump(&b);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+enum {
+	TRACE_ARG_SINCE,
+	TRACE_ARG_RAW,
+	__TRACE_ARG_MAX
+};
+
+static const struct blobmsg_policy trace_arg[__TRACE_ARG_MAX] = {
+	[TRACE_ARG_SINCE] = { .name = "since", .type = BLOBMSG_TYPE_INT32 },
+	[TRACE_ARG_RAW] = { .name = "raw", .type = BLOBMSG_TYPE_BOOL },
+};
+
+static int
+usteer_ubus_get_trace(struct ubus_context *ctx, struct ubus_object *obj,
+		      struct ubus_request_data *req, const char *method,
+		      struct blob_attr *msg)
+{
+	struct blob_attr *tb[__TRACE_ARG_MAX];
+	uint32_t since = usteer_trace_head - TRACE_RING_SIZE;
+	bool raw = false;
+
+	blobmsg_parse(trace_arg, __TRACE_ARG_MAX, tb, blob_data(msg), blob_len(msg));
+	if (tb[TRACE_ARG_SINCE])
+		since = blobmsg_get_u32(tb[TRACE_ARG_SINCE]);
+	if (tb[TRACE_ARG_RAW])
+		raw = blobmsg_get_bool(tb[TRACE_ARG_RAW]);
+
+	blob_buf_init(&b, 0);
+	usteer_trace_dump(&b, since, raw);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
 static const struct ubus_method usteer_methods[] = {
 	UBUS_METHOD_NOARG("local_info", usteer_ubus_local_info),
+	UBUS_METHOD_NOARG("metrics", usteer_ubus_get_metrics),
+	UBUS_METHOD_NOARG("get_topology", usteer_ubus_get_topology),
+	UBUS_METHOD("trace", usteer_ubus_get_trace, trace_arg),
+	UBUS_METHOD_NOARG("profile", usteer_ubus_get_profile),
+	UBUS_METHOD_NOARG("memory", usteer_ubus_get_memory),
 	UBUS_METHOD_NOARG("remote_info", usteer_ubus_remote_info),
 	UBUS_METHOD_NOARG("get_clients", usteer_ubus_get_clients),
 	UBUS_METHOD("get_client_info", usteer_ubus_get_client_info, client_arg),
@@ -409,8 +640,12 @@ static struct ubus_object usteer_obj = {
 	.n_methods = ARRAY_SIZE(usteer_methods),
 };
 
-static void
-usteer_add_nr_entry(struct usteer_node *ln, struct usteer_node *node)
+/*
+ * Add the neighbor report element of a node (hex string). A preference >= 0
+ * appends a BSS Transition Candidate Preference subelement.
+ */
+static bool
+usteer_add_nr_entry(struct usteer_node *ln, struct usteer_node *node, int pref)
 {
 	struct blobmsg_policy policy[3] = {
 		{ .type = BLOBMSG_TYPE_STRING },
@@ -419,21 +654,26 @@ usteer_add_nr_entry(struct usteer_node *ln, struct usteer_node *node)
 	};
 	struct blob_attr *tb[3];
 
-	if (!node->rrm_nr)
-		return;
+	if (!node->rrm_nr || node == ln)
+		return false;
 
 	if (strcmp(ln->ssid, node->ssid) != 0)
-		return;
+		return false;
 
 	blobmsg_parse_array(policy, ARRAY_SIZE(tb), tb,
 			    blobmsg_data(node->rrm_nr),
 			    blobmsg_data_len(node->rrm_nr));
 	if (!tb[2])
-		return;
+		return false;
+
+	if (pref < 0)
+		blobmsg_add_field(&b, BLOBMSG_TYPE_STRING, "",
+				  blobmsg_data(tb[2]),
+				  blobmsg_data_len(tb[2]));
+	else
+		blobmsg_printf(&b, "", "%s0301%02x", blobmsg_get_string(tb[2]), pref);
 
-	blobmsg_add_field(&b, BLOBMSG_TYPE_STRING, "",
-			  blobmsg_data(tb[2]),
-			  blobmsg_data_len(tb[2]));
+	return true;
 }
 
 int usteer_ubus_notify_client_disassoc(struct sta_info *si)
@@ -448,44 +688,30 @@ int usteer_ubus_notify_client_disassoc(struct sta_info *si)
 	blobmsg_add_u32(&b, "duration", config.roam_kick_delay);
 	c = blobmsg_open_array(&b, "neighbors");
 	
-	struct beacon_report* filtered_local[3];
-
-	struct beacon_report *br;   
+	struct beacon_report *br;
 	int added_local_nodes = 0;
-	
-	list_for_each_entry(br, &si->beacon_reports, sta_list) {
-    	struct usteer_node *node = get_usteer_node_from_bssid(br->bssid); 
-    	if (!node) continue; 
-		                                           
-    	if(added_local_nodes < 3){
-			filtered_local[added_local_nodes] = br;
+
+	/* reports are sorted by RCPI, take the three best known nodes */
+	for (br = si->ext->beacon_reports;
+	     br < &si->ext->beacon_reports[si->ext->n_beacon_reports] &&
+	     added_local_nodes < 3; br++) {
+		node = get_usteer_node_from_bssid(br->bssid);
+		if (!node || usteer_beacon_report_expired(br))
+			continue;
+
+		if (usteer_add_nr_entry(si->node, node, -1))
 			added_local_nodes++;
-		}else{
-			u_int16_t lowest = filtered_local[0]->rcpi;
-			int index = 0;
-			for(int j = 1; j < 3; ++j){
-				if(filtered_local[j]->rcpi < lowest){
-					lowest = filtered_local[j]->rcpi;
-					index = j;
-				}
-			}
-			if(br->rsni > lowest){
-				filtered_local[index] = br; 
-			}
-		}
 	}
 
-	for(int i = 0; i < added_local_nodes; i++){
-		usteer_add_nr_entry(si->node, get_usteer_node_from_bssid(filtered_local[i]->bssid));
-	}
-	
 	if(!added_local_nodes){
 		avl_for_each_element(&local_nodes, node, avl){		
-			usteer_add_nr_entry(si->node, node);
+			if (usteer_rf_graph_is_neighbor(si->node, node))
+				usteer_add_nr_entry(si->node, node, -1);
 		}
 
 		avl_for_each_element(&remote_nodes, rn, avl) {
-			usteer_add_nr_entry(si->node, &rn->node);
+			if (usteer_rf_graph_is_neighbor(si->node, &rn->node))
+				usteer_add_nr_entry(si->node, &rn->node, -1);
 		}
 	}
 	
@@ -494,43 +720,124 @@ int usteer_ubus_notify_client_disassoc(struct sta_info *si)
 	return ubus_invoke(ubus_ctx, ln->obj_id, "wnm_disassoc_imminent", b.head, NULL, 0, 100);
 }
 
+#define BTM_MAX_CANDIDATES	4
+
+/*
+ * Ask the client to move to <target>, with the next best nodes of its hearing
+ * map as fallback candidates of lower preference. hostapd disassociates the
+ * client after roam_kick_delay if it neither moves nor answers.
+ */
+int usteer_ubus_bss_transition_request(struct sta_info *si, struct usteer_node *target)
+{
+	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
+	static uint8_t dialog_token;
+	struct beacon_report *br;
+	struct usteer_node *node;
+	int pref = 255, n = 1;
+	void *c;
+	int ret;
+
+	if (!++dialog_token)
+		dialog_token++;
+
+	blob_buf_init(&b, 0);
+	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
+	blobmsg_add_u8(&b, "disassociation_imminent", 1);
+	blobmsg_add_u32(&b, "disassociation_timer", config.roam_kick_delay);
+	blobmsg_add_u32(&b, "validity_period", 30);
+	blobmsg_add_u8(&b, "abridged", 1);
+	blobmsg_add_u32(&b, "dialog_token", dialog_token);
+	c = blobmsg_open_array(&b, "neighbors");
+	if (!usteer_add_nr_entry(si->node, target, pref)) {
+		blobmsg_close_array(&b, c);
+		return UBUS_STATUS_NOT_FOUND;
+	}
+
+	for (br = si->ext->beacon_reports;
+	     br < &si->ext->beacon_reports[si->ext->n_beacon_reports] &&
+	     n < BTM_MAX_CANDIDATES; br++) {
+		node = get_usteer_node_from_bssid(br->bssid);
+		if (!node || node == target || usteer_beacon_report_expired(br) ||
+		    !usteer_rf_graph_is_neighbor(si->node, node))
+			continue;
+
+		if (usteer_add_nr_entry(si->node, node, pref - 16 * n))
+			n++;
+	}
+	blobmsg_close_array(&b, c);
+
+	MSG(DEBUG, "request BSS transition of "MAC_ADDR_FMT" to %s (%d candidates, token %u)\n",
+	    MAC_ADDR_DATA(si->sta->addr), usteer_node_name(target), n, dialog_token);
+	TRACE_ADDR(BTM_REQUEST, si->sta->addr, target->freq, n, dialog_token);
+
+	ret = ubus_invoke(ubus_ctx, ln->obj_id, "bss_transition_request", b.head, NULL, 0, 100);
+	if (ret)
+		return ret;
+
+	si->ext->btm.pending = 1;
+	si->ext->btm.dialog_token = dialog_token;
+	si->ext->btm.time = current_time;
+	memcpy(si->ext->btm.target, target->bssid, sizeof(si->ext->btm.target));
+	ln->btm.sent++;
+	usteer_metric_inc(&m_btm_requests);
+
+	return 0;
+}
+
 int usteer_ubus_trigger_client_scan(struct sta_info *si)
 {
 	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
 
-	si->scan_band = !si->scan_band;
+	si->ext->scan_band = !si->ext->scan_band;
 
-	MSG_T_STA("load_kick_reason_code", si->sta->addr,
-		"tell hostapd to issue a client beacon request (5ghz: %d)\n",
-		si->scan_band);
+	TRACE_ADDR(CLIENT_SCAN, si->sta->addr, si->ext->scan_band);
 
 	blob_buf_init(&b, 0);
 	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
 	blobmsg_add_u32(&b, "mode", 1);
 	blobmsg_add_u32(&b, "duration", 65535);
 	blobmsg_add_u32(&b, "channel", 255);
-	blobmsg_add_u32(&b, "op_class", si->scan_band ? 1 : 12);
+	blobmsg_add_u32(&b, "op_class", si->ext->scan_band ? 1 : 12);
 	return ubus_invoke(ubus_ctx, ln->obj_id, "rrm_beacon_req", b.head, NULL, 0, 100);
 }
 
-void usteer_ubus_kick_client(struct sta_info *si)
+void usteer_ubus_kick_client(struct sta_info *si, enum usteer_steer_reason reason,
+			     struct usteer_node *target)
 {
 	struct usteer_local_node *ln = container_of(si->node, struct usteer_local_node, node);
+	uint64_t start;
+	int ret;
+
+	MSG(DEBUG, "kick "MAC_ADDR_FMT" with reason code %u (%s)\n",
+	    MAC_ADDR_DATA(si->sta->addr), config.load_kick_reason_code, steer_reasons[reason]);
+	TRACE_ADDR(KICK, si->sta->addr, config.load_kick_reason_code, reason);
 
-	MSG_T_STA("load_kick_reason_code", si->sta->addr,
-		"tell hostapd to kick client with reason code %u\n",
-		config.load_kick_reason_code);
+	usteer_sta_roam_add(si, reason, target);
+	usteer_metric_inc_idx(&m_kicks, reason);
 
 	blob_buf_init(&b, 0);
 	blobmsg_printf(&b, "addr", MAC_ADDR_FMT, MAC_ADDR_DATA(si->sta->addr));
 	blobmsg_add_u32(&b, "reason", config.load_kick_reason_code);
 	blobmsg_add_u8(&b, "deauth", 1);
-	ubus_invoke(ubus_ctx, ln->obj_id, "del_client", b.head, NULL, 0, 100);
+	start = usteer_probe_time();
+	ret = ubus_invoke(ubus_ctx, ln->obj_id, "del_client", b.head, NULL, 0, 100);
+	USTEER_PROBE(kick, si->sta->addr, usteer_node_name(si->node),
+		     target ? usteer_node_name(target) : NULL, reason, ret,
+		     usteer_probe_time() - start);
 	si->connected = 0;
-	si->roam_kick = current_time;
+	si->ext->roam_kick = current_time;
+	usteer_sta_info_update_timeout(si, config.local_sta_timeout);
 }
 
+static uloop_fd_handler ubus_fd_cb;
+
+USTEER_PROFILE_FD(UBUS, ubus_fd_cb)
+
 void usteer_ubus_init(struct ubus_context *ctx)
 {
 	ubus_add_object(ctx, &usteer_obj);
+
+	/* everything dispatched by libubus runs from its fd handler */
+	ubus_fd_cb = ctx->sock.cb;
+	ctx->sock.cb = ubus_fd_cb_profiled;
 }
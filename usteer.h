@@ -76,6 +76,7 @@ struct usteer_node {
 	int n_assoc;
 	int max_assoc;
 	int load;
+	int airtime;
 };
 
 struct usteer_scan_request {
@@ -119,6 +120,7 @@ struct usteer_node_handler {
 			   void (*cb)(void *priv, struct usteer_survey_data *d));
 	void (*get_freqlist)(struct usteer_node *, void *,
 			     void (*cb)(void *priv, struct usteer_freq_data *f));
+	/* only starts the scan, cb is called from the event loop when it finished */
 	int (*scan)(struct usteer_node *, struct usteer_scan_request *,
 		    void *, void (*cb)(void *priv, struct usteer_scan_result *r));
 };
@@ -132,6 +134,15 @@ struct usteer_config {
 	uint32_t local_sta_timeout;
 	uint32_t local_sta_update;
 
+	uint32_t probe_sta_timeout;
+	uint32_t probe_sta_promote_time;
+	uint32_t probe_dedup_window;
+	uint32_t event_rate_limit;
+	uint32_t event_rate_limit_sta;
+
+	uint32_t max_stations;
+	uint32_t max_probe_stations;
+
 	uint32_t max_retry_band;
 	uint32_t seen_policy_timeout;
 
@@ -154,6 +165,14 @@ struct usteer_config {
 	int32_t roam_trigger_snr;
 	uint32_t roam_trigger_interval;
 
+	uint32_t roam_predict_time;
+
+	uint32_t steer_backoff_max;
+	uint32_t steer_revert_timeout;
+
+	uint32_t signal_filter;
+	uint32_t signal_filter_alpha;
+
 	uint32_t roam_kick_delay;
 
 	uint32_t initial_connect_delay;
@@ -167,9 +186,22 @@ struct usteer_config {
 	uint32_t kick_client_active_sec;
 	uint32_t kick_client_active_bits;
 
+	uint32_t airtime_kick_threshold;
+	uint32_t airtime_kick_delay;
+	uint32_t airtime_kick_throughput;
+
 	uint32_t beacon_report_invalide_timeout;
 	uint32_t beacon_request_frequency;
 	uint32_t beacon_request_signal_modifier;
+	uint32_t beacon_request_rate;
+	uint32_t beacon_request_burst;
+	uint32_t hearing_map_share_interval;
+
+	uint32_t rf_scan_interval;
+	uint32_t rf_neighbor_min_count;
+	uint32_t rrm_nr_max_entries;
+
+	uint32_t profile_stall_threshold;
 
 	const char *node_up_script;
 };
@@ -179,6 +211,8 @@ struct sta_info_stats {
 	uint32_t blocked_cur;
 	uint32_t blocked_total;
 	uint32_t blocked_last_time;
+	uint32_t last_time; /* of the last evaluated request */
+	bool last_ret;
 };
 
 #define __roam_trigger_states \
@@ -195,32 +229,129 @@ enum roam_trigger_state {
 #undef _S
 };
 
+#define __steer_reasons \
+	_R(ROAM) \
+	_R(SNR) \
+	_R(LOAD) \
+	_R(AIRTIME)
+
+enum usteer_steer_reason {
+#define _R(n) STEER_REASON_##n,
+	__steer_reasons
+#undef _R
+	__STEER_REASON_MAX
+};
+
+#define STA_ROAM_HISTORY	4
+
+struct sta_roam_entry {
+	uint8_t from[6];
+	uint8_t to[6]; /* zero until the client associates again */
+	uint8_t target[6]; /* intended node, zero if unknown */
+	uint8_t reason;
+	uint8_t reverted;
+	uint8_t local; /* steered by one of our nodes */
+	uint8_t pending; /* outcome not known yet */
+	uint64_t time;
+};
+
+#define STEER_LATENCY_BUCKETS	8
+
+/* outcome of the steers of one local node, for a single reason */
+struct usteer_steer_stats {
+	uint32_t steered;
+	uint32_t target; /* reassociated to the intended node */
+	uint32_t other; /* reassociated to another node */
+	uint32_t returned; /* reassociated to the node it was kicked from */
+	uint32_t reverted; /* came back later, within steer_revert_timeout */
+	uint32_t lost; /* no association seen within steer_revert_timeout */
+	uint32_t latency[STEER_LATENCY_BUCKETS]; /* time to reconnect */
+};
+
+#define STA_ACTIVE_SAMPLES	16
+#define STA_ACTIVE_BURST	2
+
+struct sta_active_sample {
+	uint64_t time;
+	uint64_t rx;
+	uint64_t tx;
+};
+
+/*
+ * ring of byte counter samples, spaced kick_client_active_sec / (STA_ACTIVE_SAMPLES - 1)
+ * apart so that the oldest sample marks the start of the averaging window
+ */
 struct sta_active_bytes {
-	uint64_t data[2][2];
+	struct sta_active_sample samples[STA_ACTIVE_SAMPLES];
+	uint8_t head;
+	uint8_t count;
+	uint64_t peak;
+};
+
+#define STA_SIGNAL_HISTORY	8
+
+/* periodic (nl80211 average) signal samples of connected stations */
+struct sta_signal_history {
+	uint64_t time[STA_SIGNAL_HISTORY];
+	int16_t signal[STA_SIGNAL_HISTORY];
+	uint8_t head;
+	uint8_t count;
+};
+
+enum usteer_signal_filter {
+	SIGNAL_FILTER_NONE,
+	SIGNAL_FILTER_EWMA,
+	SIGNAL_FILTER_KALMAN,
+};
+
+/* fixed point (1/256 dB) smoothing state, input is the median of the last 3 samples */
+struct sta_signal_filter {
+	int16_t raw[3];
+	uint8_t count;
+	uint8_t head;
+	int32_t estimate;
+	int32_t variance;
+};
+
+struct sta_airtime {
+	uint32_t tx_bitrate; /* kbit/s */
+	uint32_t rx_bitrate; /* kbit/s */
+	uint32_t expected_throughput; /* kbit/s */
+	uint64_t duration; /* tx + rx airtime, usec */
 	uint64_t last_time;
+	uint16_t share; /* permille of the last sampling interval */
 };
 
 struct beacon_request {
 	int band; // scan other bands
 	uint8_t failed_requests; // fallback methods
+	uint32_t priority; // scheduler, 0 if not due
 	uint64_t lastReportTime;
 	uint64_t lastRequestTime;
 };
 
-struct sta_info {
-	struct list_head list;
-	struct list_head node_list;
-	struct list_head beacon_reports;
+#define STA_BEACON_REPORTS	8
 
-	struct usteer_node *node;
-	struct sta *sta;
+struct beacon_report {
+	uint8_t bssid[6];
+	uint16_t rcpi;
+	uint16_t rsni;
+	uint16_t op_class;
+	uint16_t channel;
+	uint64_t usteer_time;
+};
 
-	struct usteer_timeout timeout;
+/* state only kept for stations of local nodes */
+struct sta_info_ext {
+	/* sorted by RCPI, best first, expired entries are skipped */
+	struct beacon_report beacon_reports[STA_BEACON_REPORTS];
+	uint8_t n_beacon_reports;
 
 	struct sta_info_stats stats[__EVENT_TYPE_MAX];
 	uint64_t created;
-	uint64_t seen;
-	int signal;
+	int signal_raw;
+	struct sta_signal_filter signal_filter;
+	struct sta_signal_history signal_history;
 
 	enum roam_trigger_state roam_state;
 	uint8_t roam_tries;
@@ -230,20 +361,104 @@ struct sta_info {
 
 	int kick_count;
 	struct sta_active_bytes active_bytes;
+	struct sta_airtime airtime;
 	struct beacon_request beacon_request;
+	uint64_t hearing_map_sent;
+
+	/* last directed BSS transition request */
+	struct {
+		uint64_t time;
+		uint8_t target[6];
+		uint8_t dialog_token;
+		uint8_t pending : 1;
+	} btm;
 
 	uint8_t scan_band : 1;
+};
+
+struct sta_info {
+	/* walked on every policy decision, keep within 32 bytes on 32 bit */
+	struct list_head list;
+	struct list_head node_list;
+
+	struct usteer_node *node;
+	struct sta *sta;
+
+	uint32_t seen; /* truncated current_time, use usteer_sta_info_age() */
+	int16_t signal;
 	uint8_t connected : 2;
+
+	struct usteer_timeout timeout;
+	struct sta_info_ext *ext; /* set for local nodes only */
+};
+
+/* eviction classes of the station table, in eviction order */
+#define __sta_lru_classes \
+	_L(NEW) \
+	_L(REMOTE) \
+	_L(IDLE) \
+	_L(CONNECTED)
+
+enum usteer_sta_lru {
+#define _L(n) STA_LRU_##n,
+	__sta_lru_classes
+#undef _L
+	__STA_LRU_MAX
+};
+
+/* 802.11k/v features advertised by a client in its (re)association request */
+#define __sta_caps \
+	_C(NEIGHBOR_REPORT) \
+	_C(BEACON_PASSIVE) \
+	_C(BEACON_ACTIVE) \
+	_C(BEACON_TABLE) \
+	_C(BTM)
+
+enum usteer_sta_cap {
+#define _C(n) STA_CAP_##n,
+	__sta_caps
+#undef _C
+	__STA_CAP_MAX
 };
 
 struct sta {
 	struct avl_node avl;
 	struct list_head nodes;
+	struct list_head lru;
 
 	uint8_t seen_2ghz : 1;
 	uint8_t seen_5ghz : 1;
+	uint8_t associated : 1;
+	uint8_t lru_class;
 
 	uint8_t addr[6];
+
+	/* bits of enum usteer_sta_cap, caps is only valid where caps_known is set */
+	uint8_t caps;
+	uint8_t caps_known;
+
+	struct sta_roam_entry roam_history[STA_ROAM_HISTORY];
+	struct usteer_timeout steer_timeout;
+	uint8_t roam_head;
+	uint8_t roam_count;
+	uint8_t steer_backoff;
+};
+
+/*
+ * Station only seen probing so far (e.g. randomized MACs). Kept out of the
+ * full station table and remote updates until it authenticates.
+ */
+struct usteer_probe_sta {
+	struct avl_node avl;
+	struct list_head lru;
+
+	uint64_t created;
+	uint64_t seen;
+
+	uint8_t addr[6];
+	int8_t signal_2ghz; /* 0 if not seen on the band */
+	int8_t signal_5ghz;
+	uint8_t blocked;
 };
 
 extern struct ubus_context *ubus_ctx;
@@ -252,35 +467,95 @@ extern struct list_head node_handlers;
 extern struct avl_tree stations;
 extern uint64_t current_time;
 extern const char * const event_types[__EVENT_TYPE_MAX];
+extern const char * const steer_reasons[__STEER_REASON_MAX];
+extern const uint32_t steer_latency_buckets[STEER_LATENCY_BUCKETS];
+extern const char * const sta_lru_classes[__STA_LRU_MAX];
+extern const char * const sta_caps[__STA_CAP_MAX];
+extern struct avl_tree probe_stations;
+
+static inline uint32_t usteer_sta_info_age(struct sta_info *si)
+{
+	return (uint32_t) current_time - si->seen;
+}
+
+/* capabilities hostapd did not report are assumed to be supported */
+static inline bool usteer_sta_has_cap(struct sta *sta, enum usteer_sta_cap cap)
+{
+	return !(sta->caps_known & (1 << cap)) || (sta->caps & (1 << cap));
+}
+
+/* tokens are kept in 1/1000, refilled at <rate> per second up to <burst> */
+struct usteer_token_bucket {
+	uint64_t last;
+	uint32_t tokens;
+};
+
+static inline bool
+usteer_token_bucket_take(struct usteer_token_bucket *tb, uint32_t rate, uint32_t burst)
+{
+	uint64_t tokens = tb->tokens + (current_time - tb->last) * rate;
+
+	if (tokens > burst * 1000)
+		tokens = burst * 1000;
+
+	tb->last = current_time;
+	if (tokens < 1000) {
+		tb->tokens = tokens;
+		return false;
+	}
+
+	tb->tokens = tokens - 1000;
+	return true;
+}
 
 void usteer_update_time(void);
+void usteer_update_time_coarse(void);
 void usteer_init_defaults(void);
 bool usteer_handle_sta_event(struct usteer_node *node, const uint8_t *addr,
 			    enum usteer_event_type type, int freq, int signal);
 
 void usteer_local_nodes_init(struct ubus_context *ctx);
 void usteer_local_node_kick(struct usteer_local_node *ln);
+void usteer_local_node_rrm_nr_dirty(const uint8_t *bssid);
 
+void usteer_sta_info_add_active_bytes(struct sta_info *si, uint64_t rx, uint64_t tx);
 uint64_t usteer_get_client_active_bits(struct sta_info *si);
+uint64_t usteer_get_client_burst_bits(struct sta_info *si);
+bool usteer_sta_info_signal_trend(struct sta_info *si, int time, int *slope, int *projected);
+bool usteer_sta_info_near_roam(struct sta_info *si);
+bool usteer_node_congested(struct usteer_node *node);
 
 void usteer_ubus_init(struct ubus_context *ctx);
-void usteer_ubus_kick_client(struct sta_info *si);
+void usteer_ubus_kick_client(struct sta_info *si, enum usteer_steer_reason reason,
+			     struct usteer_node *target);
 int usteer_ubus_trigger_client_scan(struct sta_info *si);
 int usteer_ubus_notify_client_disassoc(struct sta_info *si);
+int usteer_ubus_bss_transition_request(struct sta_info *si, struct usteer_node *target);
+void usteer_roam_btm_response(struct sta_info *si, uint8_t dialog_token,
+			      uint8_t status, const uint8_t *target);
 
 struct sta *usteer_sta_get(const uint8_t *addr, bool create);
 struct sta_info *usteer_sta_info_get(struct sta *sta, struct usteer_node *node, bool *create);
 
 void usteer_sta_info_update_timeout(struct sta_info *si, int timeout);
 void usteer_sta_info_update(struct sta_info *si, int signal, bool avg);
+void usteer_sta_info_assoc(struct sta_info *si);
+
+struct sta_roam_entry *usteer_sta_roam_last(struct sta *sta);
+void usteer_sta_roam_add(struct sta_info *si, enum usteer_steer_reason reason,
+			 struct usteer_node *target);
+void usteer_sta_roam_merge(struct sta *sta, const struct sta_roam_entry *entry);
+bool usteer_sta_steer_cooldown(struct sta *sta);
 
 static inline const char *usteer_node_name(struct usteer_node *node)
 {
 	return node->avl.key;
 }
-void usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val);
+bool usteer_node_set_blob(struct blob_attr **dest, struct blob_attr *val);
 
 bool usteer_check_request(struct sta_info *si, enum usteer_event_type type);
+bool usteer_check_probe_request(struct usteer_node *node, struct usteer_probe_sta *ps,
+				int signal);
 
 void config_set_interfaces(struct blob_attr *data);
 void config_get_interfaces(struct blob_buf *buf);
@@ -288,6 +563,11 @@ void config_get_interfaces(struct blob_buf *buf);
 void config_set_node_up_script(struct blob_attr *data);
 void config_get_node_up_script(struct blob_buf *buf);
 
+void usteer_trace_dump(struct blob_buf *buf, uint32_t since, bool raw);
+
+void config_set_prometheus_listen(struct blob_attr *data);
+void config_get_prometheus_listen(struct blob_buf *buf);
+
 void config_set_ssid(struct blob_attr *data);
 void config_get_ssid(struct blob_buf *buf);
 bool usteer_is_valid_ssid(const char *ssid);
@@ -20,8 +20,16 @@
 #ifndef __APMGR_UTILS_H
 #define __APMGR_UTILS_H
 
-#define MSG(_nr, _format, ...) debug_msg(MSG_##_nr, __func__, __LINE__, _format, ##__VA_ARGS__)
-#define MSG_CONT(_nr, _format, ...) debug_msg_cont(MSG_##_nr, _format, ##__VA_ARGS__)
+/* arguments are only evaluated when the message is enabled */
+#define MSG(_nr, _format, ...) do {						\
+	if (config.debug_level >= MSG_##_nr)					\
+		debug_msg(MSG_##_nr, __func__, __LINE__, _format, ##__VA_ARGS__); \
+} while (0)
+
+#define MSG_CONT(_nr, _format, ...) do {					\
+	if (config.debug_level >= MSG_##_nr)					\
+		debug_msg_cont(MSG_##_nr, _format, ##__VA_ARGS__);		\
+} while (0)
 
 #define MAC_ADDR_FMT "%02x:%02x:%02x:%02x:%02x:%02x"
 #define MAC_ADDR_DATA(_a) \
@@ -32,13 +40,6 @@
 	((const uint8_t *)(_a))[4], \
 	((const uint8_t *)(_a))[5]
 
-#define MSG_T_STA(_option, _sta_addr, _format, ...) \
-	MSG(DEBUG_ALL, "TESTCASE=" _option ",STA=" MAC_ADDR_FMT ": "  _format, \
-	MAC_ADDR_DATA(_sta_addr), ##__VA_ARGS__)
-
-#define MSG_T(_option,  _format, ...) \
-	MSG(DEBUG_ALL, "TESTCASE=" _option ": "  _format,  ##__VA_ARGS__)
-
 enum usteer_debug {
 	MSG_FATAL,
 	MSG_INFO,